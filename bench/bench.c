@@ -0,0 +1,309 @@
+/**
+ *  bench.c - control loop microbenchmark against a fake sysfs tree
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  Notes:
+ *    One iteration is get_temp() -> controller -> set_fan_speed().
+ *    Syscalls and allocations are counted by a shim: the Makefile links
+ *    with -Wl,--wrap for the libc entry points used by the control loop,
+ *    so only calls made by mbpfan itself are counted.
+ *    The "steady" mode keeps the temperature constant, so fan writes are
+ *    suppressed; the "write" mode forces a new fan speed every iteration.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <syslog.h>
+#include <stdbool.h>
+#include "global.h"
+#include "mbpfan.h"
+#include "sampler.h"
+#include "fakesysfs.h"
+#include "discovery.h"
+
+int daemonize = 0;
+int verbose = 0;
+
+const char *PROGRAM_NAME = "mbpfan-bench";
+const char *PROGRAM_PID = "/dev/null";
+const char *settings_path = NULL;
+
+#define BENCH_NSEC 100000000L   // time spent on each configuration
+
+static const int bench_sensors[] = { 1, 4, 16, 64 };
+
+//
+// Counting shim
+//
+
+static long syscall_count = 0;
+static long alloc_count = 0;
+
+ssize_t __real_pread(int fd, void *buf, size_t count, off_t offset);
+ssize_t __real_pwrite(int fd, const void *buf, size_t count, off_t offset);
+int __real_open(const char *path, int flags, ...);
+int __real_close(int fd);
+int __real_poll(void *fds, unsigned long nfds, int timeout);
+long __real_syscall(long number, ...);
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+ssize_t __wrap_pread(int fd, void *buf, size_t count, off_t offset)
+{
+    syscall_count++;
+    return __real_pread(fd, buf, count, offset);
+}
+
+ssize_t __wrap_pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+    syscall_count++;
+    return __real_pwrite(fd, buf, count, offset);
+}
+
+int __wrap_open(const char *path, int flags, ...)
+{
+    va_list ap;
+    va_start(ap, flags);
+    int mode = va_arg(ap, int);
+    va_end(ap);
+
+    syscall_count++;
+    return __real_open(path, flags, mode);
+}
+
+int __wrap_close(int fd)
+{
+    syscall_count++;
+    return __real_close(fd);
+}
+
+int __wrap_poll(void *fds, unsigned long nfds, int timeout)
+{
+    syscall_count++;
+    return __real_poll(fds, nfds, timeout);
+}
+
+long __wrap_syscall(long number, ...)
+{
+    va_list ap;
+    long args[6];
+
+    va_start(ap, number);
+    for (int i = 0; i < 6; i++) {
+        args[i] = va_arg(ap, long);
+    }
+    va_end(ap);
+
+    syscall_count++;
+    return __real_syscall(number, args[0], args[1], args[2], args[3], args[4], args[5]);
+}
+
+void *__wrap_malloc(size_t size)
+{
+    alloc_count++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    alloc_count++;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    alloc_count++;
+    return __real_realloc(ptr, size);
+}
+
+//
+// Benchmark
+//
+
+static long now_nsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void free_lists(t_sensors *sensors, t_fans *fans)
+{
+    sampler_close();
+
+    while (fans != NULL) {
+        t_fans *next = fans->next;
+        free(fans->name);
+        if (fans->file != NULL) {
+            fclose(fans->file);
+        }
+        if (fans->manual_fd != -1) {
+            close(fans->manual_fd);
+        }
+        free(fans->fan_output_path);
+        free(fans->fan_manual_path);
+        free(fans);
+        fans = next;
+    }
+
+    while (sensors != NULL) {
+        t_sensors *next = sensors->next;
+        if (sensors->file != NULL) {
+            fclose(sensors->file);
+        }
+        if (sensors->threshold_file != NULL) {
+            fclose(sensors->threshold_file);
+        }
+        if (sensors->alarm_fd != -1) {
+            close(sensors->alarm_fd);
+        }
+        free(sensors->path);
+        free(sensors->label);
+        free(sensors->driver);
+        free(sensors);
+        sensors = next;
+    }
+}
+
+static void bench(int sensor_count, int fan_count, bool force_writes)
+{
+    char *root = fake_sysfs_create(sensor_count, fan_count);
+
+    if (root == NULL) {
+        fprintf(stderr, "Could not create a fake sysfs tree\n");
+        exit(EXIT_FAILURE);
+    }
+
+    set_sysfs_root(root);
+    *fan_list = '\0';
+
+    // discovery logs unconditionally, keep the table readable
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int null_fd = __real_open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+
+    t_sensors *sensors = retrieve_sensors();
+    t_fans *fans = retrieve_fans();
+
+    t_state_classic state_classic;
+    t_state_pid state_pid;
+    float temp = get_temp(sensors);
+
+    if (pid_values) {
+        fan_speed_pid_init(&state_pid, NULL);
+        state_pid.interval = polling_interval;
+    } else {
+        fan_speed_classic_init(&state_classic, temp, NULL);
+    }
+
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    __real_close(saved_stdout);
+    __real_close(null_fd);
+
+    long iterations = 0;
+    long syscalls_before = syscall_count;
+    long allocs_before = alloc_count;
+    long start = now_nsec();
+    long elapsed = 0;
+
+    while (elapsed < BENCH_NSEC) {
+        for (int i = 0; i < 100; i++) {
+            temp = get_temp(sensors);
+
+            int fan_speed = pid_values
+                ? fan_speed_pid(temp, &state_pid)
+                : fan_speed_classic(temp, &state_classic);
+
+            if (force_writes) {
+                fan_speed += (iterations & 1) * 100;
+            }
+
+            set_fan_speed(fans, fan_speed);
+            iterations++;
+        }
+
+        elapsed = now_nsec() - start;
+    }
+
+    printf("%7d %4d %-6s %12.0f %14.2f %12.2f\n", sensor_count, fan_count,
+           force_writes ? "write" : "steady",
+           (double)elapsed / iterations,
+           (double)(syscall_count - syscalls_before) / iterations,
+           (double)(alloc_count - allocs_before) / iterations);
+
+    free_lists(sensors, fans);
+    set_sysfs_root("/sys");
+    fake_sysfs_destroy(root);
+}
+
+int main(int argc, char *argv[])
+{
+    int c;
+
+    while ((c = getopt(argc, argv, "c:uh")) != -1) {
+        switch (c) {
+        case 'c':
+            settings_path = optarg;
+            break;
+
+        case 'u':
+            use_io_uring = true;
+            break;
+
+        default:
+            printf("Usage: %s [-c <file>] [-u]\n", argv[0]);
+            printf("\t-c <file> Use the controller settings of <file>\n");
+            printf("\t-u Read the sensors through io_uring\n");
+            exit(EXIT_SUCCESS);
+        }
+    }
+
+    min_fan_speed = 2000;
+    max_fan_speed = 6200;
+
+    // the fake trees must never replace the cache of the real machine
+    *discovery_cache = '\0';
+
+    for (int i = 0; i < MAX_FANS; i++) {
+        fan_ratios[i] = 1.0;
+        fan_min_speeds[i] = min_fan_speed;
+        fan_max_speeds[i] = max_fan_speed;
+    }
+
+    if (settings_path != NULL) {
+        const bool io_uring = use_io_uring;
+        retrieve_settings(settings_path);
+        use_io_uring = use_io_uring || io_uring;
+    }
+
+    printf("Controller: %s, sensor backend: %s\n\n", pid_values ? "PID" : "classic",
+           use_io_uring ? "io_uring" : "pread");
+    printf("sensors fans mode      ns/iter  syscalls/iter  allocs/iter\n");
+
+    for (unsigned int s = 0; s < sizeof(bench_sensors) / sizeof(bench_sensors[0]); s++) {
+        for (int fans = 1; fans <= MAX_FANS; fans++) {
+            bench(bench_sensors[s], fans, false);
+            bench(bench_sensors[s], fans, true);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,184 @@
+/**
+ *  aggregate.c - reduction of the sensor readings to one temperature
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  Notes:
+ *    A plain mean mixes the package sensor with the cores and hides a
+ *    single hot core under single-threaded load, max or topk react to it.
+ *    Samples are kept in a flat array refreshed once per poll.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "global.h"
+#include "mbpfan.h"
+#include "aggregate.h"
+
+t_samples sensor_samples;
+t_history sensor_history[MAX_SENSORS];
+
+t_aggregation temp_aggregation = { AGGREGATE_MEAN, 2 };
+char sensor_labels[128] = "";
+char sensor_weights[256] = "";
+
+int aggregation_mode(const char *name)
+{
+    if (strcmp(name, "mean") == 0) {
+        return AGGREGATE_MEAN;
+    } else if (strcmp(name, "max") == 0) {
+        return AGGREGATE_MAX;
+    } else if (strcmp(name, "topk") == 0) {
+        return AGGREGATE_TOPK;
+    }
+
+    return -1;
+}
+
+// Return the next item of a comma-delimited list without its surrounding spaces
+static const char *next_item(const char *list, size_t *len)
+{
+    while (*list == ' ') {
+        list++;
+    }
+
+    const char *end = strchr(list, ',');
+    *len = end != NULL ? (size_t)(end - list) : strlen(list);
+
+    while (*len > 0 && list[*len - 1] == ' ') {
+        (*len)--;
+    }
+
+    return list;
+}
+
+bool label_listed(const char *prefixes, const char *label)
+{
+    for (const char *item = prefixes; item != NULL && *item != '\0'; ) {
+        size_t len;
+        item = next_item(item, &len);
+
+        if (len > 0 && strncmp(label, item, len) == 0) {
+            return true;
+        }
+
+        item = strchr(item, ',');
+
+        if (item != NULL) {
+            item++;
+        }
+    }
+
+    return false;
+}
+
+float sensor_weight(const char *label)
+{
+    // "<label prefix>:<weight>" items, the first matching prefix wins
+    for (const char *item = sensor_weights; item != NULL && *item != '\0'; ) {
+        size_t len;
+        item = next_item(item, &len);
+
+        const char *colon = memchr(item, ':', len);
+
+        if (colon != NULL && strncmp(label, item, colon - item) == 0) {
+            return atof(colon + 1);
+        }
+
+        item = strchr(item, ',');
+
+        if (item != NULL) {
+            item++;
+        }
+    }
+
+    return 1.0;
+}
+
+void samples_update(t_sensors *sensors, double time)
+{
+    int count = 0;
+
+    for (t_sensors *sensor = sensors; sensor != NULL && count < MAX_SENSORS; sensor = sensor->next) {
+        sensor_samples.temp[count] = sensor->temperature;
+        sensor_samples.weight[count] = sensor->weight;
+
+        if (sensor_history[count].window != temp_window) {
+            history_init(&sensor_history[count], temp_window);
+        }
+        history_push(&sensor_history[count], time, sensor->temperature / 1000.0);
+        count++;
+    }
+
+    sensor_samples.count = count;
+}
+
+float aggregate_temp(const t_samples *samples, uint64_t mask, const t_aggregation *aggregation)
+{
+    int temp[MAX_SENSORS];
+    float weight[MAX_SENSORS];
+    int count = 0;
+
+    for (int i = 0; i < samples->count; i++) {
+        if ((mask & (1ULL << i)) && samples->weight[i] > 0) {
+            temp[count] = samples->temp[i];
+            weight[count] = samples->weight[i];
+            count++;
+        }
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+    if (aggregation->mode == AGGREGATE_MAX) {
+        int hottest = temp[0];
+
+        for (int i = 1; i < count; i++) {
+            if (temp[i] > hottest) hottest = temp[i];
+        }
+
+        return hottest / 1000.0;
+    }
+
+    if (aggregation->mode == AGGREGATE_TOPK && aggregation->topk < count) {
+        // insertion sort, hottest first
+        for (int i = 1; i < count; i++) {
+            const int t = temp[i];
+            const float w = weight[i];
+            int j = i - 1;
+
+            while (j >= 0 && temp[j] < t) {
+                temp[j + 1] = temp[j];
+                weight[j + 1] = weight[j];
+                j--;
+            }
+
+            temp[j + 1] = t;
+            weight[j + 1] = w;
+        }
+
+        count = aggregation->topk;
+    }
+
+    double sum_temp = 0;
+    double sum_weight = 0;
+
+    for (int i = 0; i < count; i++) {
+        sum_temp += temp[i] * weight[i];
+        sum_weight += weight[i];
+    }
+
+    return sum_temp / (sum_weight * 1000);
+}
@@ -0,0 +1,86 @@
+/**
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _AGGREGATE_H_
+#define _AGGREGATE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "mbpfan.h"
+
+/** Latest reading of every sensor, in the order of the sensors list
+ *  temp - millidegrees
+ *  weight - sensor_weights entry matching the sensor label, 0 ignores it
+ */
+typedef struct {
+    int count;
+    int temp[MAX_SENSORS];
+    float weight[MAX_SENSORS];
+} t_samples;
+
+extern t_samples sensor_samples;
+
+/** Samples of each sensor, in the order of the sensors list, exported
+ *  as the trend and extremes of each sensor by the metrics
+ */
+extern t_history sensor_history[MAX_SENSORS];
+
+/** How the sensors are reduced to one temperature
+ *  mean - weighted mean of the sensors
+ *  max - hottest sensor
+ *  topk - weighted mean of the topk hottest sensors
+ */
+enum { AGGREGATE_MEAN, AGGREGATE_MAX, AGGREGATE_TOPK };
+
+typedef struct {
+    int mode;
+    int topk;
+} t_aggregation;
+
+/** Aggregation settings
+ *  temp_aggregation - temp_aggregate and temp_topk, also the default of the zones
+ *  sensor_labels - comma-delimited label prefixes of the sensors to use, empty for all
+ *  sensor_weights - comma-delimited "<label prefix>:<weight>" items
+ */
+extern t_aggregation temp_aggregation;
+extern char sensor_labels[128];
+extern char sensor_weights[256];
+
+/**
+ * Return the AGGREGATE_* value of "mean", "max" or "topk", -1 if unknown
+ */
+int aggregation_mode(const char *name);
+
+/**
+ * Return true if label starts with one of the comma-delimited prefixes
+ */
+bool label_listed(const char *prefixes, const char *label);
+
+/**
+ * Return the weight given by sensor_weights to a sensor label, 1 if none
+ */
+float sensor_weight(const char *label);
+
+/**
+ * Copy the temperatures and weights of the sensors list into sensor_samples
+ * and add them to sensor_history, time is when they were read in seconds
+ */
+void samples_update(t_sensors *sensors, double time);
+
+/**
+ * Reduce the samples selected by mask (bit i for the i-th sample)
+ * to a temperature in degrees
+ */
+float aggregate_temp(const t_samples *samples, uint64_t mask, const t_aggregation *aggregation);
+
+#endif
@@ -0,0 +1,831 @@
+/**
+ *  config.c - immutable settings snapshots for hot reload
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  Notes:
+ *    A reload parses and validates the whole file into the spare one of
+ *    two snapshots, then publishes it with a single atomic pointer store.
+ *    The control loop copies the published snapshot into the globals at
+ *    the start of a tick, so a reload never changes a setting mid-tick
+ *    and a bad file leaves the running settings untouched.
+ *    The loop announces the snapshot it is copying, the writer never
+ *    reuses that one; with a single loop thread this never blocks a reload.
+ *    Settings the subsystems only read at startup (sockets, files, the
+ *    sensors and fans found, the scheduling) keep their startup value on
+ *    a reload, so the published settings always describe the daemon.
+ *    The file is watched through its directory: editors and config pushes
+ *    usually write a temporary file and rename it over the old one, which
+ *    would silently drop a watch set on the file itself.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <errno.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include "global.h"
+#include "mbpfan.h"
+#include "settings.h"
+#include "filter.h"
+#include "history.h"
+#include "config.h"
+#include "events.h"
+#include "control.h"
+#include "telemetry.h"
+#include "metrics.h"
+#include "journal.h"
+#include "state.h"
+#include "realtime.h"
+
+#define max(a,b) ((a) > (b) ? (a) : (b))
+
+typedef struct {
+    t_config config;
+    unsigned long generation;
+} t_snapshot;
+
+static t_snapshot snapshots[2];
+static t_snapshot *published = NULL;  // latest valid settings
+static t_snapshot *reading = NULL;    // being applied by the loop
+static unsigned long applied = 0;     // generation in use by the loop
+static unsigned long generation = 0;
+
+// storage for pid_values while PID control is enabled
+static float pid_constants[3];
+
+bool config_watch = true;
+
+static char watch_path[256];    // configuration file being watched
+static char watch_name[256];    // its name in the watched directory
+static int inotify_fd = -1;
+static int debounce_fd = -1;
+
+// why the last config_reload() failed
+static char reload_error[256];
+
+// settings of the last config_load(), the ones only read at startup stay in use
+static t_config startup;
+static bool started = false;
+
+unsigned long config_reloads = 0;
+unsigned long config_reload_failures = 0;
+
+void config_capture(t_config *config)
+{
+    memset(config, 0, sizeof(*config));
+
+    config->min_fan_speed = min_fan_speed;
+    config->max_fan_speed = max_fan_speed;
+    config->low_temp = low_temp;
+    config->high_temp = high_temp;
+    config->max_temp = max_temp;
+    config->polling_interval = polling_interval;
+    config->adaptive_polling_max = adaptive_polling_max;
+    config->adaptive_polling_fast_ms = adaptive_polling_fast_ms;
+    config->adaptive_polling_slope = adaptive_polling_slope;
+    config->adaptive_polling_margin = adaptive_polling_margin;
+    config->fan_deadband = fan_deadband;
+    config->fan_dwell = fan_dwell;
+    strcpy(config->sensor_drivers, sensor_drivers);
+    config->use_alarms = use_alarms;
+    config->use_io_uring = use_io_uring;
+    config->temp_window = temp_window;
+    config->temp_aggregation = temp_aggregation;
+    strcpy(config->sensor_labels, sensor_labels);
+    strcpy(config->sensor_weights, sensor_weights);
+    config->filter_oversample = filter_oversample;
+    config->filter_process_noise = filter_process_noise;
+    config->filter_measurement_noise = filter_measurement_noise;
+    strcpy(config->fan_list, fan_list);
+    memcpy(config->fan_ratios, fan_ratios, sizeof(config->fan_ratios));
+    memcpy(config->fan_min_speeds, fan_min_speeds, sizeof(config->fan_min_speeds));
+    memcpy(config->fan_max_speeds, fan_max_speeds, sizeof(config->fan_max_speeds));
+    config->pid = pid_values != NULL;
+
+    if (pid_values) {
+        memcpy(config->pid_values, pid_values, sizeof(config->pid_values));
+    }
+
+    memcpy(config->zones, zone_configs, sizeof(config->zones));
+    config->zone_count = zone_count;
+    config->watch = config_watch;
+    strcpy(config->control_socket, control_socket);
+    strcpy(config->telemetry_shm, telemetry_shm);
+    strcpy(config->metrics_listen, metrics_listen);
+    strcpy(config->journal_path, journal_path);
+    config->journal_size = journal_size;
+    strcpy(config->state_path, state_path);
+    config->state_max_age = state_max_age;
+    config->realtime_priority = realtime_priority;
+    config->housekeeping_cpu = housekeeping_cpu;
+}
+
+void config_apply(const t_config *config)
+{
+    min_fan_speed = config->min_fan_speed;
+    max_fan_speed = config->max_fan_speed;
+    low_temp = config->low_temp;
+    high_temp = config->high_temp;
+    max_temp = config->max_temp;
+    polling_interval = config->polling_interval;
+    adaptive_polling_max = config->adaptive_polling_max;
+    adaptive_polling_fast_ms = config->adaptive_polling_fast_ms;
+    adaptive_polling_slope = config->adaptive_polling_slope;
+    adaptive_polling_margin = config->adaptive_polling_margin;
+    fan_deadband = config->fan_deadband;
+    fan_dwell = config->fan_dwell;
+    strcpy(sensor_drivers, config->sensor_drivers);
+    use_alarms = config->use_alarms;
+    use_io_uring = config->use_io_uring;
+    temp_window = config->temp_window;
+    temp_aggregation = config->temp_aggregation;
+    strcpy(sensor_labels, config->sensor_labels);
+    strcpy(sensor_weights, config->sensor_weights);
+    filter_oversample = config->filter_oversample;
+    filter_process_noise = config->filter_process_noise;
+    filter_measurement_noise = config->filter_measurement_noise;
+    strcpy(fan_list, config->fan_list);
+    memcpy(fan_ratios, config->fan_ratios, sizeof(fan_ratios));
+    memcpy(fan_min_speeds, config->fan_min_speeds, sizeof(fan_min_speeds));
+    memcpy(fan_max_speeds, config->fan_max_speeds, sizeof(fan_max_speeds));
+
+    if (config->pid) {
+        memcpy(pid_constants, config->pid_values, sizeof(pid_constants));
+        pid_values = pid_constants;
+    } else {
+        pid_values = NULL;
+    }
+
+    memcpy(zone_configs, config->zones, sizeof(zone_configs));
+    zone_count = config->zone_count;
+    config_watch = config->watch;
+    strcpy(control_socket, config->control_socket);
+    strcpy(telemetry_shm, config->telemetry_shm);
+    strcpy(metrics_listen, config->metrics_listen);
+    strcpy(journal_path, config->journal_path);
+    journal_size = config->journal_size;
+    strcpy(state_path, config->state_path);
+    state_max_age = config->state_max_age;
+    realtime_priority = config->realtime_priority;
+    housekeeping_cpu = config->housekeeping_cpu;
+}
+
+static bool read_general(const Settings *settings, t_config *config, char *error, size_t size)
+{
+    int result = 0;
+
+    result = settings_get_int(settings, "general", "min_fan_speed");
+
+    if (result != 0) {
+        config->min_fan_speed = result;
+    }
+
+    result = settings_get_int(settings, "general", "max_fan_speed");
+
+    if (result != 0) {
+        config->max_fan_speed = result;
+    }
+
+    result = settings_get_int(settings, "general", "low_temp");
+
+    if (result != 0) {
+        config->low_temp = result;
+    }
+
+    result = settings_get_int(settings, "general", "high_temp");
+
+    if (result != 0) {
+        config->high_temp = result;
+    }
+
+    result = settings_get_int(settings, "general", "max_temp");
+
+    if (result != 0) {
+        config->max_temp = result;
+    }
+
+    result = settings_get_int(settings, "general", "polling_interval");
+
+    if (result != 0) {
+        config->polling_interval = result;
+    }
+
+    result = settings_get_int(settings, "general", "adaptive_polling_max");
+
+    if (result != 0) {
+        config->adaptive_polling_max = result;
+    }
+
+    result = settings_get_int(settings, "general", "adaptive_polling_fast_ms");
+
+    if (result != 0) {
+        config->adaptive_polling_fast_ms = result;
+    }
+
+    double slope = settings_get_double(settings, "general", "adaptive_polling_slope");
+
+    if (slope != 0) {
+        config->adaptive_polling_slope = slope;
+    }
+
+    result = settings_get_int(settings, "general", "adaptive_polling_margin");
+
+    if (result != 0) {
+        config->adaptive_polling_margin = result;
+    }
+
+    char sensor_drivers_temp[sizeof(config->sensor_drivers)];
+    result = settings_get(settings, "general", "sensor_drivers", sensor_drivers_temp, sizeof(sensor_drivers_temp));
+
+    if (result != 0) {
+        strcpy(config->sensor_drivers, sensor_drivers_temp);
+    }
+
+    char temp_aggregate_temp[16];
+    result = settings_get(settings, "general", "temp_aggregate", temp_aggregate_temp, sizeof(temp_aggregate_temp));
+
+    if (result != 0) {
+        config->temp_aggregation.mode = aggregation_mode(temp_aggregate_temp);
+
+        if (config->temp_aggregation.mode == -1) {
+            snprintf(error, size, "Unknown temp_aggregate '%s', use mean, max or topk", temp_aggregate_temp);
+            return false;
+        }
+    }
+
+    result = settings_get_int(settings, "general", "temp_topk");
+
+    if (result != 0) {
+        config->temp_aggregation.topk = result;
+    }
+
+    result = settings_get(settings, "general", "sensor_labels", config->sensor_labels, sizeof(config->sensor_labels));
+
+    if (result == 0) {
+        *config->sensor_labels = '\0';
+    }
+
+    result = settings_get(settings, "general", "sensor_weights", config->sensor_weights, sizeof(config->sensor_weights));
+
+    if (result == 0) {
+        *config->sensor_weights = '\0';
+    }
+
+    result = settings_get_int(settings, "general", "filter_oversample");
+
+    if (result != 0) {
+        config->filter_oversample = result;
+    }
+
+    double noise = settings_get_double(settings, "general", "filter_process_noise");
+
+    if (noise != 0) {
+        config->filter_process_noise = noise;
+    }
+
+    noise = settings_get_double(settings, "general", "filter_measurement_noise");
+
+    if (noise != 0) {
+        config->filter_measurement_noise = noise;
+    }
+
+    result = settings_get_int(settings, "general", "temp_window");
+
+    if (result != 0) {
+        config->temp_window = result;
+    }
+
+    result = settings_get_int(settings, "general", "fan_deadband");
+
+    if (result != 0) {
+        config->fan_deadband = result;
+    }
+
+    result = settings_get_int(settings, "general", "fan_dwell");
+
+    if (result != 0) {
+        config->fan_dwell = result;
+    }
+
+    // 0 is a valid value, it cannot go through settings_get_int()
+    char alarm_wakeups_temp[16];
+    result = settings_get(settings, "general", "alarm_wakeups", alarm_wakeups_temp, sizeof(alarm_wakeups_temp));
+
+    if (result != 0) {
+        if (strcmp(alarm_wakeups_temp, "1") == 0 || strcmp(alarm_wakeups_temp, "yes") == 0) {
+            config->use_alarms = true;
+        } else if (strcmp(alarm_wakeups_temp, "0") == 0 || strcmp(alarm_wakeups_temp, "no") == 0) {
+            config->use_alarms = false;
+        } else {
+            snprintf(error, size, "Unknown alarm_wakeups '%s', use 1 or 0", alarm_wakeups_temp);
+            return false;
+        }
+    }
+
+    char sensor_backend_temp[16];
+    result = settings_get(settings, "general", "sensor_backend", sensor_backend_temp, sizeof(sensor_backend_temp));
+
+    if (result != 0) {
+        config->use_io_uring = strcmp(sensor_backend_temp, "io_uring") == 0;
+    }
+
+    char config_watch_temp[16];
+    result = settings_get(settings, "general", "config_watch", config_watch_temp, sizeof(config_watch_temp));
+
+    if (result != 0) {
+        config->watch = strcmp(config_watch_temp, "no") != 0 && strcmp(config_watch_temp, "0") != 0;
+    }
+
+    char control_socket_temp[sizeof(config->control_socket)];
+    result = settings_get(settings, "general", "control_socket", control_socket_temp, sizeof(control_socket_temp));
+
+    if (result != 0) {
+        strcpy(config->control_socket, strcmp(control_socket_temp, "no") == 0 ? "" : control_socket_temp);
+    }
+
+    char telemetry_shm_temp[sizeof(config->telemetry_shm)];
+    result = settings_get(settings, "general", "telemetry_shm", telemetry_shm_temp, sizeof(telemetry_shm_temp));
+
+    if (result != 0) {
+        strcpy(config->telemetry_shm, strcmp(telemetry_shm_temp, "no") == 0 ? "" : telemetry_shm_temp);
+    }
+
+    result = settings_get(settings, "general", "metrics_listen", config->metrics_listen, sizeof(config->metrics_listen));
+
+    if (result == 0) {
+        *config->metrics_listen = '\0';
+    }
+
+    result = settings_get(settings, "general", "journal", config->journal_path, sizeof(config->journal_path));
+
+    if (result == 0) {
+        *config->journal_path = '\0';
+    }
+
+    result = settings_get_int(settings, "general", "journal_size");
+
+    if (result != 0) {
+        config->journal_size = result;
+    }
+
+    char state_file_temp[sizeof(config->state_path)];
+    result = settings_get(settings, "general", "state_file", state_file_temp, sizeof(state_file_temp));
+
+    if (result != 0) {
+        strcpy(config->state_path, strcmp(state_file_temp, "no") == 0 ? "" : state_file_temp);
+    }
+
+    result = settings_get_int(settings, "general", "state_max_age");
+
+    if (result != 0) {
+        config->state_max_age = result;
+    }
+
+    result = settings_get_int(settings, "general", "realtime_priority");
+
+    if (result != 0) {
+        config->realtime_priority = result;
+    }
+
+    // CPU 0 is a valid value, it cannot go through settings_get_int()
+    char housekeeping_cpu_temp[16];
+    result = settings_get(settings, "general", "housekeeping_cpu", housekeeping_cpu_temp, sizeof(housekeeping_cpu_temp));
+
+    if (result != 0) {
+        char *end;
+        config->housekeeping_cpu = strcmp(housekeeping_cpu_temp, "no") == 0
+            ? -1 : (int)strtol(housekeeping_cpu_temp, &end, 10);
+
+        if (config->housekeeping_cpu != -1 && (end == housekeeping_cpu_temp || *end != '\0')) {
+            snprintf(error, size, "Unknown housekeeping_cpu '%s', use a CPU number or no", housekeeping_cpu_temp);
+            return false;
+        }
+    }
+
+    char fan_list_temp[sizeof(config->fan_list)];
+    result = settings_get(settings, "general", "fan_list", fan_list_temp, sizeof(fan_list_temp));
+
+    if (result != 0) {
+        strcpy(config->fan_list, fan_list_temp);
+    }
+
+    double fan_ratios_temp[MAX_FANS];
+    result = settings_get_double_tuple(settings, "general", "fan_ratios", fan_ratios_temp, MAX_FANS, NULL);
+
+    for (int i = 0; i < MAX_FANS; i++) {
+        config->fan_ratios[i] = (result != 0) ? max(0.1, fan_ratios_temp[i]) : 1.0;
+    }
+
+    result = settings_get_int_tuple(settings, "general", "fan_min_speeds", config->fan_min_speeds, MAX_FANS, NULL);
+
+    if (result == 0) {
+        for (int i = 0; i < MAX_FANS; i++) config->fan_min_speeds[i] = config->min_fan_speed;
+    }
+
+    result = settings_get_int_tuple(settings, "general", "fan_max_speeds", config->fan_max_speeds, MAX_FANS, NULL);
+
+    if (result == 0) {
+        for (int i = 0; i < MAX_FANS; i++) config->fan_max_speeds[i] = config->max_fan_speed;
+    }
+
+    int pid_values_temp[10];
+    unsigned int readCount = 0;
+    result = settings_get_int_tuple(settings, "general", "pid_values", pid_values_temp, 10, &readCount);
+
+    if (result != 0) {
+        if (readCount != 3) {
+            snprintf(error, size, "Wrong number of PID constants, 3 expected.");
+            return false;
+        }
+        config->pid = true;
+        config->pid_values[0] = pid_values_temp[0];
+        config->pid_values[1] = pid_values_temp[1];
+        config->pid_values[2] = pid_values_temp[2];
+    }
+
+    return true;
+}
+
+bool config_read(const char *path, t_config *config, char *error, size_t size)
+{
+    FILE *f = fopen(path == NULL ? "/etc/mbpfan.conf" : path, "r");
+
+    if (f == NULL) {
+        /* Could not open configfile */
+        if(verbose) {
+            LOG("Couldn't open configfile, using defaults");
+        }
+        return true;
+    }
+
+    Settings *settings = settings_open(f);
+    fclose(f);
+
+    if (settings == NULL) {
+        snprintf(error, size, "Couldn't read configfile");
+        return false;
+    }
+
+    bool valid = read_general(settings, config, error, size);
+
+    if (valid) {
+        // zones inherit the [general] values they do not override
+        t_zone_config defaults;
+        memset(&defaults, 0, sizeof(defaults));
+        defaults.thresholds.low_temp = config->low_temp;
+        defaults.thresholds.high_temp = config->high_temp;
+        defaults.thresholds.max_temp = config->max_temp;
+        defaults.thresholds.min_fan_speed = config->min_fan_speed;
+        defaults.thresholds.max_fan_speed = config->max_fan_speed;
+        memcpy(defaults.thresholds.pid_values, config->pid_values, sizeof(defaults.thresholds.pid_values));
+        defaults.aggregation = config->temp_aggregation;
+        defaults.pid = config->pid;
+
+        config->zone_count = zones_read_settings(settings, &defaults, config->zones, error, size);
+        valid = config->zone_count != -1;
+    }
+
+    /* Destroy the settings object */
+    settings_delete(settings);
+
+    return valid;
+}
+
+bool config_validate(const t_config *config, char *error, size_t size)
+{
+    if (config->min_fan_speed > config->max_fan_speed) {
+        snprintf(error, size, "Invalid fan speeds: min_fan_speed %d, max_fan_speed %d",
+                 config->min_fan_speed, config->max_fan_speed);
+        return false;
+    }
+    // equal thresholds would make a step of the classic controller divide by zero
+    if (config->low_temp >= config->high_temp || config->high_temp >= config->max_temp) {
+        snprintf(error, size, "Invalid temperatures: low_temp %d, high_temp %d, max_temp %d",
+                 config->low_temp, config->high_temp, config->max_temp);
+        return false;
+    }
+    if (config->polling_interval < 1) {
+        snprintf(error, size, "Invalid polling_interval %d", config->polling_interval);
+        return false;
+    }
+    if (config->adaptive_polling_max != 0 &&
+        (config->adaptive_polling_max < config->polling_interval || config->adaptive_polling_fast_ms <= 0 ||
+         config->adaptive_polling_fast_ms > config->polling_interval * 1000)) {
+        snprintf(error, size, "Invalid adaptive polling: fast %d ms, polling_interval %d s, max %d s",
+                 config->adaptive_polling_fast_ms, config->polling_interval, config->adaptive_polling_max);
+        return false;
+    }
+    if (config->filter_oversample < 1 || config->filter_oversample > FILTER_MAX_OVERSAMPLE ||
+        config->filter_process_noise < 0 || config->filter_measurement_noise < 0) {
+        snprintf(error, size, "Invalid filter: filter_oversample %d (1 to %d), process noise %.3f, measurement noise %.3f",
+                 config->filter_oversample, FILTER_MAX_OVERSAMPLE,
+                 config->filter_process_noise, config->filter_measurement_noise);
+        return false;
+    }
+    if (config->temp_window < 2 || config->temp_window > HISTORY_SIZE) {
+        snprintf(error, size, "Invalid temp_window %d, between 2 and %d samples", config->temp_window, HISTORY_SIZE);
+        return false;
+    }
+    if (config->temp_aggregation.topk < 1) {
+        snprintf(error, size, "Invalid temp_topk %d", config->temp_aggregation.topk);
+        return false;
+    }
+    if (config->fan_deadband < 0 || config->fan_dwell < 0) {
+        snprintf(error, size, "Invalid fan write suppression: fan_deadband %d, fan_dwell %d",
+                 config->fan_deadband, config->fan_dwell);
+        return false;
+    }
+    if (config->journal_size < JOURNAL_MIN_SIZE / 1024) {
+        snprintf(error, size, "Invalid journal_size %d KiB, at least %d KiB", config->journal_size, JOURNAL_MIN_SIZE / 1024);
+        return false;
+    }
+    if (config->state_max_age < 0) {
+        snprintf(error, size, "Invalid state_max_age %d", config->state_max_age);
+        return false;
+    }
+    if (config->realtime_priority < 0 || config->realtime_priority > REALTIME_MAX_PRIORITY) {
+        snprintf(error, size, "Invalid realtime_priority %d, between 0 and %d", config->realtime_priority, REALTIME_MAX_PRIORITY);
+        return false;
+    }
+    if (config->housekeeping_cpu < -1 || config->housekeeping_cpu >= REALTIME_MAX_CPUS) {
+        snprintf(error, size, "Invalid housekeeping_cpu %d", config->housekeeping_cpu);
+        return false;
+    }
+
+    // zones are bound once the sensors and fans have been discovered
+    if (sensors != NULL &&
+        !zones_check(config->zones, config->zone_count, sensors, fans, error, size)) {
+        return false;
+    }
+
+    return true;
+}
+
+// Return the snapshot a new configuration can be written to, NULL if none
+static t_snapshot *spare_snapshot()
+{
+    const t_snapshot *current = __atomic_load_n(&published, __ATOMIC_ACQUIRE);
+    t_snapshot *spare = current == &snapshots[0] ? &snapshots[1] : &snapshots[0];
+
+    if (spare == __atomic_load_n(&reading, __ATOMIC_SEQ_CST)) {
+        return NULL;
+    }
+
+    return spare;
+}
+
+static void publish(t_snapshot *snapshot)
+{
+    snapshot->generation = ++generation;
+    __atomic_store_n(&published, snapshot, __ATOMIC_RELEASE);
+}
+
+bool config_load(const char *path, char *error, size_t size)
+{
+    t_snapshot *snapshot = spare_snapshot();
+
+    if (snapshot == NULL) {
+        snprintf(error, size, "Settings are being applied");
+        return false;
+    }
+
+    config_capture(&snapshot->config);
+
+    if (!config_read(path, &snapshot->config, error, size) ||
+        !config_validate(&snapshot->config, error, size)) {
+        return false;
+    }
+
+    config_apply(&snapshot->config);
+    publish(snapshot);
+    applied = snapshot->generation;
+    startup = snapshot->config;
+    started = true;
+    return true;
+}
+
+#define KEEP_VALUE(field, key) \
+    do { \
+        if (memcmp(&config->field, &startup.field, sizeof(config->field)) != 0) { \
+            LOG("Keeping the running %s, it only changes on restart", key); \
+            memcpy(&config->field, &startup.field, sizeof(config->field)); \
+        } \
+    } while (false)
+
+#define KEEP_STRING(field, key) \
+    do { \
+        if (strcmp(config->field, startup.field) != 0) { \
+            LOG("Keeping the running %s, it only changes on restart", key); \
+            strcpy(config->field, startup.field); \
+        } \
+    } while (false)
+
+// Put back the settings the subsystems only read at startup
+static void keep_startup_settings(t_config *config)
+{
+    if (!started) {
+        return;
+    }
+
+    KEEP_STRING(sensor_drivers, "sensor_drivers");
+    KEEP_STRING(sensor_labels, "sensor_labels");
+    KEEP_STRING(sensor_weights, "sensor_weights");
+    KEEP_VALUE(use_alarms, "alarm_wakeups");
+    KEEP_VALUE(use_io_uring, "sensor_backend");
+    KEEP_STRING(fan_list, "fan_list");
+    KEEP_VALUE(fan_ratios, "fan_ratios");
+    KEEP_VALUE(watch, "config_watch");
+    KEEP_STRING(control_socket, "control_socket");
+    KEEP_STRING(telemetry_shm, "telemetry_shm");
+    KEEP_STRING(metrics_listen, "metrics_listen");
+    KEEP_STRING(journal_path, "journal");
+    KEEP_VALUE(journal_size, "journal_size");
+    KEEP_STRING(state_path, "state_file");
+    KEEP_VALUE(state_max_age, "state_max_age");
+    KEEP_VALUE(realtime_priority, "realtime_priority");
+    KEEP_VALUE(housekeeping_cpu, "housekeeping_cpu");
+}
+
+bool config_reload(const char *path)
+{
+    char *error = reload_error;
+    const size_t size = sizeof(reload_error);
+    t_snapshot *snapshot = spare_snapshot();
+
+    if (snapshot == NULL) {
+        snprintf(error, size, "The previous reload is being applied");
+        LOG("Not reloading the settings: %s", error);
+        config_reload_failures++;
+        return false;
+    }
+
+    const t_snapshot *current = __atomic_load_n(&published, __ATOMIC_ACQUIRE);
+
+    if (current != NULL) {
+        snapshot->config = current->config;
+    } else {
+        config_capture(&snapshot->config);
+    }
+
+    if (!config_read(path, &snapshot->config, error, size) ||
+        !config_validate(&snapshot->config, error, size)) {
+        LOG("Keeping the current settings: %s", error);
+        config_reload_failures++;
+        return false;
+    }
+
+    keep_startup_settings(&snapshot->config);
+
+    *error = '\0';
+    config_reloads++;
+    publish(snapshot);
+    return true;
+}
+
+const char *config_reload_error()
+{
+    return reload_error;
+}
+
+bool config_update()
+{
+    t_snapshot *snapshot;
+
+    // announce the snapshot before using it, then make sure it is still the published one
+    do {
+        snapshot = __atomic_load_n(&published, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&reading, snapshot, __ATOMIC_SEQ_CST);
+    } while (snapshot != __atomic_load_n(&published, __ATOMIC_SEQ_CST));
+
+    const bool changed = snapshot != NULL && snapshot->generation != applied;
+
+    if (changed) {
+        config_apply(&snapshot->config);
+        applied = snapshot->generation;
+    }
+
+    __atomic_store_n(&reading, NULL, __ATOMIC_RELEASE);
+    return changed;
+}
+
+static void on_config_change(int fd, uint32_t events, void *data)
+{
+    (void)events;
+    (void)data;
+
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+    ssize_t len;
+
+    while ((len = read(fd, buf, sizeof(buf))) > 0) {
+        for (char *ptr = buf; ptr < buf + len; ) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+
+            if (event->len > 0 && strcmp(event->name, watch_name) == 0) {
+                changed = true;
+            }
+
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    if (!changed) {
+        return;
+    }
+
+    // restart the delay, an edit is often several writes and a rename
+    struct itimerspec timer;
+    memset(&timer, 0, sizeof(timer));
+    timer.it_value.tv_sec = CONFIG_WATCH_DEBOUNCE_MS / 1000;
+    timer.it_value.tv_nsec = (CONFIG_WATCH_DEBOUNCE_MS % 1000) * 1000000L;
+    timerfd_settime(debounce_fd, 0, &timer, NULL);
+}
+
+static void on_config_settled(int fd, uint32_t events, void *data)
+{
+    (void)events;
+    (void)data;
+
+    uint64_t expirations;
+
+    if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;
+    }
+
+    LOG("Configuration file %s changed, reloading", watch_path);
+
+    if (config_reload(watch_path)) {
+        poll_now();
+    }
+}
+
+bool config_watch_start(const char *path)
+{
+    snprintf(watch_path, sizeof(watch_path), "%s", path == NULL ? "/etc/mbpfan.conf" : path);
+
+    // dirname() and basename() may modify their argument
+    char dir[sizeof(watch_path)];
+    char name[sizeof(watch_path)];
+    strcpy(dir, watch_path);
+    strcpy(name, watch_path);
+    snprintf(watch_name, sizeof(watch_name), "%s", basename(name));
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (inotify_fd == -1) {
+        return false;
+    }
+
+    if (inotify_add_watch(inotify_fd, dirname(dir), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE) == -1) {
+        close(inotify_fd);
+        inotify_fd = -1;
+        return false;
+    }
+
+    debounce_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (debounce_fd == -1 ||
+        !events_add(inotify_fd, EPOLLIN, on_config_change, NULL) ||
+        !events_add(debounce_fd, EPOLLIN, on_config_settled, NULL)) {
+        const int saved = errno;
+        config_watch_stop();
+        errno = saved;
+        return false;
+    }
+
+    if (verbose) {
+        LOG("Watching %s for changes", watch_path);
+    }
+
+    return true;
+}
+
+void config_watch_stop()
+{
+    if (debounce_fd != -1) {
+        events_remove(debounce_fd);
+        close(debounce_fd);
+        debounce_fd = -1;
+    }
+
+    if (inotify_fd != -1) {
+        events_remove(inotify_fd);
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+}
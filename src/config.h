@@ -0,0 +1,145 @@
+/**
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _CONFIG_H_
+#define _CONFIG_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "mbpfan.h"
+#include "aggregate.h"
+#include "zones.h"
+
+/** Every value read from the configuration file, see mbpfan.h for their
+ *  meaning. A snapshot is never modified once published, it holds no
+ *  pointers so it can be copied and dropped freely
+ *  fan_list - empty unless set, the fans are then discovered
+ *  pid - pid_values holds the PID constants
+ */
+typedef struct {
+    int min_fan_speed;
+    int max_fan_speed;
+    int low_temp;
+    int high_temp;
+    int max_temp;
+    int polling_interval;
+    int adaptive_polling_max;
+    int adaptive_polling_fast_ms;
+    float adaptive_polling_slope;
+    int adaptive_polling_margin;
+    int fan_deadband;
+    int fan_dwell;
+    char sensor_drivers[64];
+    bool use_alarms;
+    bool use_io_uring;
+    int temp_window;
+    t_aggregation temp_aggregation;
+    char sensor_labels[128];
+    char sensor_weights[256];
+    int filter_oversample;
+    float filter_process_noise;
+    float filter_measurement_noise;
+    char fan_list[10 * MAX_FANS];
+    float fan_ratios[MAX_FANS];
+    int fan_min_speeds[MAX_FANS];
+    int fan_max_speeds[MAX_FANS];
+    bool pid;
+    float pid_values[3];
+    t_zone_config zones[MAX_ZONES];
+    int zone_count;
+    bool watch;
+    char control_socket[108];
+    char telemetry_shm[64];
+    char metrics_listen[108];
+    char journal_path[108];
+    int journal_size;
+    char state_path[108];
+    int state_max_age;
+    int realtime_priority;
+    int housekeeping_cpu;
+} t_config;
+
+// Delay between the last change of the configuration file and its reload
+#define CONFIG_WATCH_DEBOUNCE_MS 500
+
+/** Reload the settings when the configuration file changes, default true
+ *  Read at startup, see config_watch_start()
+ */
+extern bool config_watch;
+
+/** Reloads published and rejected by config_reload() since startup */
+extern unsigned long config_reloads;
+extern unsigned long config_reload_failures;
+
+/**
+ * Copy the settings in use into config
+ */
+void config_capture(t_config *config);
+
+/**
+ * Make config the settings in use
+ */
+void config_apply(const t_config *config);
+
+/**
+ * Update config with the values of the file at path (/etc/mbpfan.conf
+ * when NULL), keys missing from the file keep their value.
+ * Return false and describe the problem in error if the file is invalid
+ */
+bool config_read(const char *path, t_config *config, char *error, size_t size);
+
+/**
+ * Return false and describe the problem in error if config is inconsistent
+ */
+bool config_validate(const t_config *config, char *error, size_t size);
+
+/**
+ * Read, validate and apply the settings right away, on top of the ones in
+ * use. Used at startup. Return false with the reason in error
+ */
+bool config_load(const char *path, char *error, size_t size);
+
+/**
+ * Read and validate the settings into a new snapshot and publish it for
+ * the control loop. The settings only read at startup keep the value of
+ * config_load(), each one changed is logged. On error the settings in use
+ * are kept and the reason is logged. Return true if a snapshot was published
+ */
+bool config_reload(const char *path);
+
+/**
+ * Return why the last config_reload() failed, empty if it succeeded
+ */
+const char *config_reload_error();
+
+/**
+ * Apply the latest published snapshot if the loop is not running it yet.
+ * Called by the control loop between two ticks.
+ * Return true if the settings changed
+ */
+bool config_update();
+
+/**
+ * Watch the directory of the configuration file at path with inotify, so
+ * in-place writes and editors renaming a new file over it are both seen.
+ * Changes are debounced, then go through config_reload() like SIGHUP.
+ * Needs events_init(). Return false if the watch could not be set
+ */
+bool config_watch_start(const char *path);
+
+/**
+ * Stop watching the configuration file
+ */
+void config_watch_stop();
+
+#endif
@@ -0,0 +1,468 @@
+/**
+ *  control.c - UNIX socket to query and steer the running daemon
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  Notes:
+ *    Line protocol: one request per line, answered by data lines and a
+ *    final "ok" or "error <reason>" line. Names and labels, which may
+ *    hold spaces, always come last on a data line.
+ *    The socket is served by the event loop between two control ticks.
+ *    Responses are sent without blocking, a client that does not read
+ *    them is dropped rather than stalling the fans.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "global.h"
+#include "mbpfan.h"
+#include "aggregate.h"
+#include "config.h"
+#include "events.h"
+#include "control.h"
+#include "realtime.h"
+
+char control_socket[108] = "/run/mbpfan.sock";
+
+typedef struct {
+    int fd;
+    size_t len;
+    char line[CONTROL_LINE_MAX];
+} t_client;
+
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+} t_reply;
+
+static int listen_fd = -1;
+static char socket_path[sizeof(control_socket)];
+static t_client clients[CONTROL_MAX_CLIENTS];
+
+static t_zone *loop_zones = NULL;
+static int *loop_zone_count = NULL;
+
+// Base speed forced on each fan of the list until until_ms, 0 when not overridden
+static struct {
+    int speed;
+    int rpm;    // as requested
+    long until_ms;
+} overrides[MAX_FANS];
+
+static long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+static void reply(t_reply *r, const char *fmt, ...)
+{
+    if (r->len >= r->size) {
+        return;
+    }
+
+    va_list ap;
+    va_start(ap, fmt);
+    const int len = vsnprintf(r->buf + r->len, r->size - r->len, fmt, ap);
+    va_end(ap);
+
+    if (len > 0) {
+        r->len = r->len + len < r->size ? r->len + len : r->size - 1;
+    }
+}
+
+static int read_fan_input(const t_fans *fan)
+{
+    char *path = smprintf("%s/fan%d_input", applesmc_path, fan->fan_id);
+    FILE *file = fopen(path, "r");
+    int rpm = -1;
+
+    free(path);
+
+    if (file != NULL) {
+        if (fscanf(file, "%d", &rpm) != 1) {
+            rpm = -1;
+        }
+        fclose(file);
+    }
+
+    return rpm;
+}
+
+static void query_status(t_reply *r)
+{
+    int speed = 0;
+    int pid_zones = 0;
+
+    for (int i = 0; loop_zones != NULL && i < *loop_zone_count; i++) {
+        speed = loop_zones[i].speed > speed ? loop_zones[i].speed : speed;
+        pid_zones += loop_zones[i].config.pid;
+    }
+
+    const int zone_count = loop_zone_count != NULL ? *loop_zone_count : 0;
+
+    reply(r, "temp %.1f\n", history_len(&temp_history) > 0 ? history_last(&temp_history) : 0);
+    reply(r, "slope %.3f\n", history_slope(&temp_history));
+    reply(r, "speed %d\n", speed);
+    reply(r, "zones %d\n", zone_count);
+    reply(r, "controller %s\n", pid_zones == 0 ? "classic" : pid_zones == zone_count ? "pid" : "mixed");
+    reply(r, "ticks %lu\n", (unsigned long)loop_histograms[PHASE_READ].total);
+    reply(r, "realtime %d\n", realtime_active());
+    reply(r, "pid %d\n", (int)getpid());
+}
+
+static void query_sensors(t_reply *r)
+{
+    int index = 0;
+
+    for (t_sensors *sensor = sensors; sensor != NULL && index < sensor_samples.count; sensor = sensor->next, index++) {
+        reply(r, "sensor %d temp %.3f weight %.2f driver %s label %s\n", index,
+              sensor_samples.temp[index] / 1000.0, sensor_samples.weight[index],
+              sensor->driver != NULL ? sensor->driver : "-", sensor->label);
+    }
+}
+
+static void query_fans(t_reply *r)
+{
+    const long now = now_ms();
+    int index = 0;
+
+    for (t_fans *fan = fans; fan != NULL && index < MAX_FANS; fan = fan->next, index++) {
+        const bool overridden = overrides[index].speed != 0 && overrides[index].until_ms > now;
+
+        reply(r, "fan %d target %d actual %d min %d max %d writes %lu suppressed %lu override %d name %s\n",
+              index, fan->old_speed, read_fan_input(fan), fan->min_speed, fan->max_speed,
+              fan->writes, fan->suppressed, overridden ? overrides[index].rpm : 0, fan->name);
+    }
+}
+
+static void query_zones(t_reply *r)
+{
+    for (int i = 0; loop_zones != NULL && i < *loop_zone_count; i++) {
+        const t_zone *zone = &loop_zones[i];
+
+        if (zone->config.pid) {
+            reply(r, "zone %d pid temp %.3f speed %d integral %.3f error_prior %.3f name %s\n",
+                  i, zone->temp, zone->speed, zone->pid.integral, zone->pid.error_prior, zone->config.name);
+        } else {
+            reply(r, "zone %d classic temp %.3f speed %d name %s\n",
+                  i, zone->temp, zone->speed, zone->config.name);
+        }
+    }
+}
+
+static void query_stats(t_reply *r)
+{
+    for (int i = 0; i < LOOP_PHASES; i++) {
+        const t_histogram *h = &loop_histograms[i];
+
+        reply(r, "phase %s count %lu p50_ns %lu p99_ns %lu max_ns %lu\n", loop_phase_names[i],
+              (unsigned long)h->total,
+              (unsigned long)histogram_percentile(h, 0.5),
+              (unsigned long)histogram_percentile(h, 0.99),
+              (unsigned long)h->max);
+    }
+}
+
+// Return false if the request is malformed
+static bool command_override(const char *args)
+{
+    char target[16];
+    int speed = 0;
+    int seconds = CONTROL_OVERRIDE_SECONDS;
+
+    if (sscanf(args, "%15s", target) == 1 && strcmp(target, "clear") == 0) {
+        memset(overrides, 0, sizeof(overrides));
+        return true;
+    }
+
+    const int count = sscanf(args, "%15s %d %d", target, &speed, &seconds);
+
+    if (count < 2 || speed <= 0 || seconds <= 0) {
+        return false;
+    }
+
+    char *end;
+    const long index = strtol(target, &end, 10);
+    const bool all = strcmp(target, "all") == 0;
+    int fan_count = 0;
+
+    for (t_fans *fan = fans; fan != NULL && fan_count < MAX_FANS; fan = fan->next) {
+        fan_count++;
+    }
+
+    if (!all && (*end != '\0' || index < 0 || index >= fan_count)) {
+        return false;
+    }
+
+    const long until = now_ms() + seconds * 1000L;
+    int i = 0;
+
+    for (t_fans *fan = fans; fan != NULL && i < MAX_FANS; fan = fan->next, i++) {
+        if (all || i == index) {
+            // the base speed is scaled by the fan ratio when written
+            overrides[i].speed = ceil(speed / fan->speed_ratio);
+            overrides[i].rpm = speed;
+            overrides[i].until_ms = until;
+            LOG("Fan %s overridden to %d RPM for %d s", fan->name, speed, seconds);
+        }
+    }
+
+    return true;
+}
+
+size_t control_request(const char *line, char *response, size_t size)
+{
+    t_reply r = { response, size, 0 };
+    char command[16] = "";
+    char args[CONTROL_LINE_MAX] = "";
+    char error[128] = "";
+    bool changed = false;   // a command the loop must act on at once
+
+    *response = '\0';
+    sscanf(line, "%15s %255[^\n]", command, args);
+
+    if (strcmp(command, "status") == 0) {
+        query_status(&r);
+
+    } else if (strcmp(command, "sensors") == 0) {
+        query_sensors(&r);
+
+    } else if (strcmp(command, "fans") == 0) {
+        query_fans(&r);
+
+    } else if (strcmp(command, "zones") == 0) {
+        query_zones(&r);
+
+    } else if (strcmp(command, "stats") == 0) {
+        query_stats(&r);
+
+    } else if (strcmp(command, "override") == 0) {
+        if (!command_override(args)) {
+            snprintf(error, sizeof(error), "usage: override <fan|all> <rpm> [seconds] | override clear");
+        }
+        changed = true;
+
+    } else if (strcmp(command, "controller") == 0) {
+        const bool pid = strcmp(args, "pid") == 0;
+
+        if (!pid && strcmp(args, "classic") != 0) {
+            snprintf(error, sizeof(error), "usage: controller <pid|classic>");
+        } else if (loop_zones == NULL) {
+            snprintf(error, sizeof(error), "the control loop is not running");
+        } else if (zones_set_controller(loop_zones, *loop_zone_count, pid, error, sizeof(error))) {
+            LOG("Switched to the %s controller", args);
+            changed = true;
+        }
+
+    } else if (strcmp(command, "reload") == 0) {
+        if (!config_reload(settings_path)) {
+            snprintf(error, sizeof(error), "%s", config_reload_error());
+        }
+        changed = true;
+
+    } else if (strcmp(command, "help") == 0) {
+        reply(&r, "queries: status sensors fans zones stats\n");
+        reply(&r, "commands: override <fan|all> <rpm> [seconds], override clear, controller <pid|classic>, reload\n");
+
+    } else {
+        snprintf(error, sizeof(error), "unknown request '%s', try help", command);
+    }
+
+    if (*error) {
+        // keep room for the final line even if the data was truncated
+        r.len = 0;
+        reply(&r, "error %s\n", error);
+    } else {
+        reply(&r, "ok\n");
+    }
+
+    if (changed && !*error) {
+        poll_now();
+    }
+
+    return r.len;
+}
+
+bool control_override(int *speeds, long now_ms)
+{
+    bool active = false;
+
+    for (int i = 0; i < MAX_FANS; i++) {
+        if (overrides[i].speed == 0) {
+            continue;
+        }
+
+        if (overrides[i].until_ms <= now_ms) {
+            overrides[i].speed = 0;
+            continue;
+        }
+
+        speeds[i] = overrides[i].speed;
+        active = true;
+    }
+
+    return active;
+}
+
+static void drop_client(t_client *client)
+{
+    events_remove(client->fd);
+    close(client->fd);
+    client->fd = -1;
+}
+
+static void on_client(int fd, uint32_t events, void *data)
+{
+    (void)events;
+
+    t_client *client = data;
+    static char response[16384];
+    ssize_t len;
+
+    while ((len = read(fd, client->line + client->len, sizeof(client->line) - client->len)) > 0) {
+        client->len += len;
+
+        char *newline;
+        while ((newline = memchr(client->line, '\n', client->len)) != NULL) {
+            *newline = '\0';
+            const size_t consumed = newline - client->line + 1;
+            const size_t length = control_request(client->line, response, sizeof(response));
+
+            if (send(fd, response, length, MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)length) {
+                drop_client(client);
+                return;
+            }
+
+            client->len -= consumed;
+            memmove(client->line, client->line + consumed, client->len);
+        }
+
+        if (client->len == sizeof(client->line)) {
+            const char *message = "error request too long\n";
+            send(fd, message, strlen(message), MSG_NOSIGNAL | MSG_DONTWAIT);
+            drop_client(client);
+            return;
+        }
+    }
+
+    if (len == 0 || errno != EAGAIN) {
+        drop_client(client);
+    }
+}
+
+static void on_connect(int fd, uint32_t events, void *data)
+{
+    (void)events;
+    (void)data;
+
+    int client_fd;
+
+    while ((client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        t_client *client = NULL;
+
+        for (int i = 0; i < CONTROL_MAX_CLIENTS && client == NULL; i++) {
+            if (clients[i].fd == -1) {
+                client = &clients[i];
+            }
+        }
+
+        if (client == NULL || !events_add(client_fd, EPOLLIN, on_client, client)) {
+            const char *message = "error too many clients\n";
+            send(client_fd, message, strlen(message), MSG_NOSIGNAL | MSG_DONTWAIT);
+            close(client_fd);
+            continue;
+        }
+
+        client->fd = client_fd;
+        client->len = 0;
+    }
+}
+
+bool control_start(const char *path, t_zone *zones, int *zone_count)
+{
+    struct sockaddr_un address;
+
+    loop_zones = zones;
+    loop_zone_count = zone_count;
+
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        clients[i].fd = -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+    snprintf(socket_path, sizeof(socket_path), "%s", path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (listen_fd == -1) {
+        return false;
+    }
+
+    // the pid file guarantees a single daemon, a socket left behind is stale
+    unlink(path);
+
+    // the socket can steer the fans, keep it to root
+    const mode_t mask = umask(0077);
+    const int bound = bind(listen_fd, (struct sockaddr *)&address, sizeof(address));
+    umask(mask);
+
+    if (bound == -1 || listen(listen_fd, CONTROL_MAX_CLIENTS) == -1 ||
+        !events_add(listen_fd, EPOLLIN, on_connect, NULL)) {
+        const int saved = errno;
+        close(listen_fd);
+        listen_fd = -1;
+        errno = saved;
+        return false;
+    }
+
+    if (verbose) {
+        LOG("Control socket listening on %s", path);
+    }
+
+    return true;
+}
+
+void control_stop()
+{
+    if (listen_fd == -1) {
+        return;
+    }
+
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        if (clients[i].fd != -1) {
+            drop_client(&clients[i]);
+        }
+    }
+
+    events_remove(listen_fd);
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(socket_path);
+}
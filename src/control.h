@@ -0,0 +1,58 @@
+/**
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _CONTROL_H_
+#define _CONTROL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "zones.h"
+
+#define CONTROL_MAX_CLIENTS 8
+// Longest request line
+#define CONTROL_LINE_MAX 256
+// Duration of an override when the request does not give one
+#define CONTROL_OVERRIDE_SECONDS 60
+
+/** Path of the UNIX control socket, empty to disable
+ *  Default is /run/mbpfan.sock
+ */
+extern char control_socket[108];
+
+/**
+ * Listen on the control socket at path and serve it from the event loop.
+ * zones and zone_count are the zones of the control loop, read and
+ * switched by the requests. Needs events_init().
+ * Return false if the socket could not be created
+ */
+bool control_start(const char *path, t_zone *zones, int *zone_count);
+
+/**
+ * Close the clients and remove the socket
+ */
+void control_stop();
+
+/**
+ * Answer one request line, without its newline, into response:
+ * data lines followed by "ok" or "error <reason>", each ending with '\n'.
+ * Return the length of the response
+ */
+size_t control_request(const char *line, char *response, size_t size);
+
+/**
+ * Replace the base speeds of the fans with a running override, at now_ms
+ * on the monotonic clock. Return true if an override is running
+ */
+bool control_override(int *speeds, long now_ms);
+
+#endif
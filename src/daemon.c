@@ -18,6 +18,7 @@
 
 
 #include <sys/prctl.h>
+#include <sys/signalfd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdio.h>
@@ -33,6 +34,17 @@
 #include "mbpfan.h"
 #include "global.h"
 #include "daemon.h"
+#include "sampler.h"
+#include "events.h"
+#include "config.h"
+#include "control.h"
+#include "telemetry.h"
+#include "metrics.h"
+#include "journal.h"
+#include "state.h"
+#include "realtime.h"
+
+static sigset_t handled_signals;
 
 int write_pid(int pid)
 {
@@ -78,7 +90,15 @@ int delete_pid()
 static void cleanup_and_exit(int exit_code)
 {
 	delete_pid();
+	config_watch_stop();
+	control_stop();
+	telemetry_close();
+	metrics_stop();
+	journal_close();
+	state_stop();
+	realtime_stop();
 	set_fans_auto(fans);
+	restore_sensor_alarms(sensors);
 
 	struct s_fans *next_fan;
 	while (fans != NULL) {
@@ -87,19 +107,33 @@ static void cleanup_and_exit(int exit_code)
 		if (fans->file != NULL) {
 			fclose(fans->file);
 		}
+		if (fans->manual_fd != -1) {
+			close(fans->manual_fd);
+		}
 		free(fans->fan_output_path);
 		free(fans->fan_manual_path);
 		free(fans);
 		fans = next_fan;
 	}
 
+	sampler_close();
+	events_close();
+
 	struct s_sensors *next_sensor;
 	while (sensors != NULL) {
 		next_sensor = sensors->next;
 		if (sensors->file != NULL) {
 			fclose(sensors->file);
 		}
+		if (sensors->threshold_file != NULL) {
+			fclose(sensors->threshold_file);
+		}
+		if (sensors->alarm_fd != -1) {
+			close(sensors->alarm_fd);
+		}
 		free(sensors->path);
+		free(sensors->label);
+		free(sensors->driver);
 		free(sensors);
 		sensors = next_sensor;
 	}
@@ -113,7 +147,13 @@ void signal_handler(int signal)
     switch(signal) {
     case SIGHUP:
         syslog(LOG_WARNING, "Received SIGHUP signal.");
-        retrieve_settings(NULL);
+        if (config_reload(settings_path)) {
+            poll_now();
+        }
+        break;
+
+    case SIGUSR1:
+        log_loop_histograms();
         break;
 
     case SIGTERM:
@@ -137,14 +177,29 @@ void signal_handler(int signal)
     }
 }
 
+static void on_signal(int fd, uint32_t events, void *data)
+{
+    (void)events;
+    (void)data;
+
+    struct signalfd_siginfo info;
+
+    while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+        signal_handler(info.ssi_signo);
+    }
+}
+
 void go_daemon(void (*fan_control)())
 {
 
-    // Setup signal handling before we start
-    signal(SIGHUP, signal_handler);
-    signal(SIGTERM, signal_handler);
-    signal(SIGQUIT, signal_handler);
-    signal(SIGINT, signal_handler);
+    // Signals are blocked and read from a signalfd by the event loop
+    sigemptyset(&handled_signals);
+    sigaddset(&handled_signals, SIGHUP);
+    sigaddset(&handled_signals, SIGTERM);
+    sigaddset(&handled_signals, SIGQUIT);
+    sigaddset(&handled_signals, SIGINT);
+    sigaddset(&handled_signals, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &handled_signals, NULL);
 
     syslog(LOG_INFO, "%s starting up", PROGRAM_NAME);
 
@@ -237,6 +292,12 @@ void go_daemon(void (*fan_control)())
         exit(EXIT_FAILURE);
     }
 
+    int signal_fd = signalfd(-1, &handled_signals, SFD_CLOEXEC | SFD_NONBLOCK);
+
+    if (signal_fd == -1 || !events_init() || !events_add(signal_fd, EPOLLIN, on_signal, NULL)) {
+        syslog(LOG_ERR, "Can not watch signals: %s. Aborting", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
 
     fan_control();
 
@@ -42,6 +42,8 @@ int delete_pid();
 
 /**
  * ...handles signals :-)
+ * Called from the event loop with the signals read from a signalfd,
+ * so it runs between two control ticks and may log and reload freely
  */
 void signal_handler(int signal);
 
@@ -0,0 +1,431 @@
+/**
+ *  discovery.c - cache of the sensors and fans found at startup
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  Notes:
+ *    A full discovery lists every hwmon device, reads their attributes and
+ *    labels, then reads the 16 applesmc fan labels and the fan limits.
+ *    The cache replaces it with a read of the cache file, uname(), a read
+ *    of the DMI product name, a listing of class/hwmon and a readlink() of
+ *    each entry. hwmonN numbers are not stable across boots, the link of
+ *    each entry to its device (.../coretemp.0/hwmon/hwmonN) is what
+ *    identifies it. The whole listing is part of the key, so a device
+ *    appearing or going away (nvme, amdgpu loaded later) invalidates it.
+ *    File: magic, version, payload length, CRC32 of the payload, then the
+ *    payload made of length-prefixed strings and 32 bit integers: the key
+ *    with the hwmon entries and their links, the sensors, the fans.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <syslog.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/utsname.h>
+#include "global.h"
+#include "mbpfan.h"
+#include "hwmon.h"
+#include "discovery.h"
+
+/* lazy max... */
+#define max(a,b) ((a) > (b) ? (a) : (b))
+
+char discovery_cache[108] = "/var/cache/mbpfan.discovery";
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t length;
+    uint32_t checksum;
+} t_discovery_header;
+
+typedef struct {
+    uint8_t *data;
+    size_t length;
+    size_t size;
+} t_writer;
+
+typedef struct {
+    const uint8_t *data;
+    size_t length;
+    size_t offset;
+    bool failed;
+} t_reader;
+
+static void put_bytes(t_writer *writer, const void *bytes, size_t length)
+{
+    if (writer->length + length > writer->size) {
+        writer->size = max(writer->size * 2, writer->length + length);
+        writer->data = realloc(writer->data, writer->size);
+    }
+
+    memcpy(writer->data + writer->length, bytes, length);
+    writer->length += length;
+}
+
+static void put_int(t_writer *writer, int32_t value)
+{
+    put_bytes(writer, &value, sizeof(value));
+}
+
+static void put_string(t_writer *writer, const char *string)
+{
+    const int32_t length = string != NULL ? strlen(string) : 0;
+    put_int(writer, length);
+    put_bytes(writer, string, length);
+}
+
+static int32_t get_int(t_reader *reader)
+{
+    int32_t value = 0;
+
+    if (reader->failed || reader->length - reader->offset < sizeof(value)) {
+        reader->failed = true;
+        return 0;
+    }
+
+    memcpy(&value, reader->data + reader->offset, sizeof(value));
+    reader->offset += sizeof(value);
+    return value;
+}
+
+// Return a copy of the next string, NULL once the reader failed
+static char *get_string(t_reader *reader)
+{
+    const int32_t length = get_int(reader);
+
+    if (reader->failed || length < 0 || (size_t)length > reader->length - reader->offset) {
+        reader->failed = true;
+        return NULL;
+    }
+
+    char *string = strndup((const char *)reader->data + reader->offset, length);
+    reader->offset += length;
+    return string;
+}
+
+static void read_trimmed(const char *path, char *buf, size_t size)
+{
+    memset(buf, 0, size);
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL) {
+        return;
+    }
+
+    size_t length = fread(buf, 1, size - 1, file);
+    fclose(file);
+
+    // Remove trailing spaces
+    while (length > 0 && isspace((unsigned char)buf[length - 1])) {
+        length--;
+    }
+
+    buf[length] = '\0';
+}
+
+static int read_value(const char *path)
+{
+    int value = -1;
+    FILE *file = fopen(path, "r");
+
+    if (file != NULL) {
+        if (fscanf(file, "%d", &value) != 1) {
+            value = -1;
+        }
+        fclose(file);
+    }
+
+    return value;
+}
+
+bool discovery_probe(t_discovery *discovery)
+{
+    memset(discovery, 0, sizeof(*discovery));
+    discovery->fan_min_speed = -1;
+    discovery->fan_max_speed = -1;
+
+    if (!hwmon_discover(sysfs_root, &discovery->index)) {
+        return false;
+    }
+
+    const char *smc_path = discovery->index.applesmc_path != NULL ? discovery->index.applesmc_path : applesmc_path;
+
+    for (int counter = 0; counter < MAX_SEARCH_FANS; counter++) {
+        char *path = smprintf("%s/fan%d_label", smc_path, counter);
+        read_trimmed(path, discovery->fan_labels[counter], sizeof(discovery->fan_labels[counter]));
+        free(path);
+    }
+
+    for (int i = 1; i <= MAX_FANS; i++) {
+        char *path = smprintf("%s/fan%d_min", smc_path, i);
+        int value = read_value(path);
+        free(path);
+
+        if (value != -1 && (discovery->fan_min_speed == -1 || value < discovery->fan_min_speed)) {
+            discovery->fan_min_speed = value;
+        }
+
+        path = smprintf("%s/fan%d_max", smc_path, i);
+        value = read_value(path);
+        free(path);
+
+        if (value != -1 && (discovery->fan_max_speed == -1 || value > discovery->fan_max_speed)) {
+            discovery->fan_max_speed = value;
+        }
+    }
+
+    return true;
+}
+
+// What the cache was made on: a different key invalidates it
+static void put_key(t_writer *writer)
+{
+    struct utsname name;
+    char product[128];
+
+    if (uname(&name) == -1) {
+        name.release[0] = '\0';
+    }
+
+    char *path = smprintf("%s/class/dmi/id/product_name", sysfs_root);
+    read_trimmed(path, product, sizeof(product));
+    free(path);
+
+    put_string(writer, name.release);
+    put_string(writer, product);
+    put_string(writer, sysfs_root);
+    put_string(writer, applesmc_path);
+
+    for (int i = 0; hwmon_drivers[i] != NULL; i++) {
+        put_string(writer, hwmon_drivers[i]);
+    }
+
+    // every hwmon entry and the device it links to, a new device is a new key
+    char *class_path = smprintf("%s/class/hwmon", sysfs_root);
+    struct dirent **entries;
+    const int count = scandir(class_path, &entries, NULL, versionsort);
+
+    put_int(writer, max(count, 0));
+
+    for (int i = 0; i < count; i++) {
+        char *path = smprintf("%s/%s", class_path, entries[i]->d_name);
+        char target[256];
+        const ssize_t length = readlink(path, target, sizeof(target) - 1);
+        target[length > 0 ? length : 0] = '\0';
+
+        put_string(writer, entries[i]->d_name);
+        put_string(writer, target);
+        free(path);
+        free(entries[i]);
+    }
+
+    if (count >= 0) {
+        free(entries);
+    }
+
+    free(class_path);
+}
+
+bool discovery_save(const char *path, const t_discovery *discovery)
+{
+    t_writer writer;
+    memset(&writer, 0, sizeof(writer));
+
+    put_key(&writer);
+
+    put_int(&writer, discovery->index.sensor_count);
+
+    for (int i = 0; i < discovery->index.sensor_count; i++) {
+        const t_hwmon_sensor *sensor = &discovery->index.sensors[i];
+        put_string(&writer, sensor->driver);
+        put_string(&writer, sensor->input_path);
+        put_string(&writer, sensor->label);
+        put_int(&writer, sensor->index);
+    }
+
+    put_string(&writer, discovery->index.applesmc_path);
+
+    for (int i = 0; i < MAX_SEARCH_FANS; i++) {
+        put_string(&writer, discovery->fan_labels[i]);
+    }
+
+    put_int(&writer, discovery->fan_min_speed);
+    put_int(&writer, discovery->fan_max_speed);
+
+    t_discovery_header header;
+    header.magic = DISCOVERY_MAGIC;
+    header.version = DISCOVERY_VERSION;
+    header.length = writer.length;
+    header.checksum = crc32(writer.data, writer.length);
+
+    char *temporary = smprintf("%s.tmp", path);
+    const int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool written = fd != -1 && write(fd, &header, sizeof(header)) == sizeof(header) &&
+                   write(fd, writer.data, writer.length) == (ssize_t)writer.length;
+
+    if (fd != -1) {
+        written = close(fd) == 0 && written;
+    }
+
+    written = written && rename(temporary, path) == 0;
+
+    if (!written) {
+        const int saved = errno;
+        unlink(temporary);
+        errno = saved;
+    }
+
+    free(temporary);
+    free(writer.data);
+    return written;
+}
+
+// Check the key of a cache payload, leave the reader after it
+static bool matches(t_reader *reader)
+{
+    t_writer key;
+    memset(&key, 0, sizeof(key));
+    put_key(&key);
+
+    const bool valid = reader->length >= key.length && memcmp(reader->data, key.data, key.length) == 0;
+    reader->offset = valid ? key.length : 0;
+    free(key.data);
+
+    return valid;
+}
+
+bool discovery_load(const char *path, t_discovery *discovery)
+{
+    memset(discovery, 0, sizeof(*discovery));
+
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1) {
+        return false;
+    }
+
+    t_discovery_header header;
+    uint8_t *data = NULL;
+    bool valid = read(fd, &header, sizeof(header)) == sizeof(header) &&
+                 header.magic == DISCOVERY_MAGIC && header.version == DISCOVERY_VERSION &&
+                 header.length <= DISCOVERY_MAX_SIZE;
+
+    if (valid) {
+        data = malloc(header.length);
+        valid = read(fd, data, header.length) == (ssize_t)header.length &&
+                crc32(data, header.length) == header.checksum;
+    }
+
+    close(fd);
+
+    t_reader reader = { .data = data, .length = valid ? header.length : 0, .offset = 0, .failed = false };
+    valid = valid && matches(&reader);
+
+    const int32_t sensor_count = valid ? get_int(&reader) : 0;
+    valid = valid && sensor_count >= 0 && sensor_count <= MAX_SENSORS;
+
+    for (int i = 0; valid && i < sensor_count; i++) {
+        t_hwmon_sensor *sensor = &discovery->index.sensors[discovery->index.sensor_count++];
+        sensor->driver = get_string(&reader);
+        sensor->input_path = get_string(&reader);
+        sensor->label = get_string(&reader);
+        sensor->index = get_int(&reader);
+        valid = !reader.failed;
+    }
+
+    if (valid) {
+        discovery->index.applesmc_path = get_string(&reader);
+
+        // "" stands for no applesmc device
+        if (discovery->index.applesmc_path != NULL && *discovery->index.applesmc_path == '\0') {
+            free(discovery->index.applesmc_path);
+            discovery->index.applesmc_path = NULL;
+        }
+    }
+
+    for (int i = 0; valid && i < MAX_SEARCH_FANS; i++) {
+        char *label = get_string(&reader);
+
+        if (label != NULL) {
+            snprintf(discovery->fan_labels[i], sizeof(discovery->fan_labels[i]), "%s", label);
+            free(label);
+        }
+    }
+
+    discovery->fan_min_speed = get_int(&reader);
+    discovery->fan_max_speed = get_int(&reader);
+    valid = valid && !reader.failed;
+
+    free(data);
+
+    if (!valid) {
+        discovery_free(discovery);
+    }
+
+    return valid;
+}
+
+void discovery_free(t_discovery *discovery)
+{
+    // hwmon_free() also frees the members an interrupted load left NULL
+    hwmon_free(&discovery->index);
+    memset(discovery, 0, sizeof(*discovery));
+}
+
+const t_discovery *discovery_get()
+{
+    static t_discovery current;
+    static char current_root[sizeof(sysfs_root)];
+    static bool known = false;
+
+    if (known && strcmp(current_root, sysfs_root) == 0) {
+        return &current;
+    }
+
+    if (known) {
+        discovery_free(&current);
+        known = false;
+    }
+
+    if (*discovery_cache && discovery_load(discovery_cache, &current)) {
+        if (verbose) {
+            LOG("Using the sensors and fans cached in %s", discovery_cache);
+        }
+
+    } else if (discovery_probe(&current)) {
+        if (*discovery_cache && !discovery_save(discovery_cache, &current) && verbose) {
+            LOG("Could not cache the sensors and fans in %s: %s", discovery_cache, strerror(errno));
+        }
+
+    } else {
+        return NULL;
+    }
+
+    // the fans are driven where the applesmc hwmon device keeps them
+    if (current.index.applesmc_path != NULL) {
+        snprintf(applesmc_path, sizeof(applesmc_path), "%s", current.index.applesmc_path);
+    }
+
+    snprintf(current_root, sizeof(current_root), "%s", sysfs_root);
+    known = true;
+    return &current;
+}
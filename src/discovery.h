@@ -0,0 +1,77 @@
+/**
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _DISCOVERY_H_
+#define _DISCOVERY_H_
+
+#include <stdbool.h>
+#include "mbpfan.h"
+#include "hwmon.h"
+
+#define DISCOVERY_MAGIC 0x6d627064  // "mbpd"
+#define DISCOVERY_VERSION 2
+// Largest cache file read
+#define DISCOVERY_MAX_SIZE (1 << 20)
+
+/** File caching the discovery across boots, empty to disable
+ *  Default is /var/cache/mbpfan.discovery when sysfs_root is /sys, read
+ *  before the discovery with sysfs_root, see retrieve_sysfs_root()
+ */
+extern char discovery_cache[108];
+
+/** What the daemon finds in sysfs at startup
+ *  index - temperature inputs of the known hwmon drivers
+ *  fan_labels - applesmc fanN_label of each fan id, empty if missing
+ *  fan_min_speed, fan_max_speed - lowest fanN_min and highest fanN_max, -1 if none
+ */
+typedef struct {
+    t_hwmon_index index;
+    char fan_labels[MAX_SEARCH_FANS][100];
+    int fan_min_speed;
+    int fan_max_speed;
+} t_discovery;
+
+/**
+ * Discover the sensors and fans under sysfs_root, the fans in the applesmc
+ * device found there or else in applesmc_path.
+ * Return false if the hwmon devices could not be listed
+ */
+bool discovery_probe(t_discovery *discovery);
+
+/**
+ * Write a discovery to path with the key of this machine: kernel release,
+ * DMI product name, sysfs_root and every hwmon entry with its device.
+ * Return false if it could not be written
+ */
+bool discovery_save(const char *path, const t_discovery *discovery);
+
+/**
+ * Read a discovery saved by discovery_save(), if it was saved on this
+ * machine and kernel with the same hwmon devices. Return false otherwise
+ */
+bool discovery_load(const char *path, t_discovery *discovery);
+
+/**
+ * Return the discovery of sysfs_root, from discovery_cache when it is
+ * valid or else probed and saved there. Done once per sysfs_root.
+ * Points applesmc_path to the applesmc device found, if any.
+ * Return NULL if the hwmon devices could not be listed
+ */
+const t_discovery *discovery_get();
+
+/**
+ * Release the memory held by a discovery
+ */
+void discovery_free(t_discovery *discovery);
+
+#endif
@@ -0,0 +1,118 @@
+/**
+ *  events.c - epoll based event loop
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  Notes:
+ *    Everything the daemon reacts to (poll timer, signals, sensor alarms)
+ *    is an fd in a single epoll set, so all work runs on the loop thread
+ *    between two handlers and a signal never lands in the middle of a
+ *    fan write.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "events.h"
+
+typedef struct {
+    int fd;
+    t_event_handler handler;
+    void *data;
+} t_event_source;
+
+static int epoll_fd = -1;
+static t_event_source sources[MAX_EVENT_SOURCES];
+
+bool events_init()
+{
+    if (epoll_fd != -1) {
+        return true;
+    }
+
+    for (int i = 0; i < MAX_EVENT_SOURCES; i++) {
+        sources[i].fd = -1;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    return epoll_fd != -1;
+}
+
+bool events_add(int fd, uint32_t events, t_event_handler handler, void *data)
+{
+    t_event_source *source = NULL;
+
+    for (int i = 0; i < MAX_EVENT_SOURCES && source == NULL; i++) {
+        if (sources[i].fd == -1) {
+            source = &sources[i];
+        }
+    }
+
+    if (source == NULL) {
+        return false;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.ptr = source;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        return false;
+    }
+
+    source->fd = fd;
+    source->handler = handler;
+    source->data = data;
+    return true;
+}
+
+void events_remove(int fd)
+{
+    for (int i = 0; i < MAX_EVENT_SOURCES; i++) {
+        if (sources[i].fd == fd) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            sources[i].fd = -1;
+        }
+    }
+}
+
+bool events_dispatch(int timeout_ms)
+{
+    struct epoll_event events[16];
+    int ready = epoll_wait(epoll_fd, events, 16, timeout_ms);
+
+    if (ready == -1) {
+        return errno == EINTR;
+    }
+
+    for (int i = 0; i < ready; i++) {
+        t_event_source *source = events[i].data.ptr;
+
+        // an earlier handler of this batch may have removed it
+        if (source->fd != -1) {
+            source->handler(source->fd, events[i].events, source->data);
+        }
+    }
+
+    return true;
+}
+
+void events_close()
+{
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+}
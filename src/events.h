@@ -0,0 +1,53 @@
+/**
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _EVENTS_H_
+#define _EVENTS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+
+// Sensor alarms, timer, signals, and room for sockets and watches
+#define MAX_EVENT_SOURCES 96
+
+/**
+ * Called from events_dispatch() when fd is ready, events holds the EPOLL* flags
+ */
+typedef void (*t_event_handler)(int fd, uint32_t events, void *data);
+
+/**
+ * Create the epoll set, return false on failure
+ */
+bool events_init();
+
+/**
+ * Call handler whenever fd reports one of the EPOLL* events
+ * Return false if the fd can not be watched (e.g. a regular file)
+ */
+bool events_add(int fd, uint32_t events, t_event_handler handler, void *data);
+
+/**
+ * Stop watching fd, the caller still owns it
+ */
+void events_remove(int fd);
+
+/**
+ * Wait up to timeout_ms (-1 forever) and run the handlers of the ready fds
+ * Return false if waiting failed
+ */
+bool events_dispatch(int timeout_ms);
+
+void events_close();
+
+#endif
@@ -0,0 +1,247 @@
+/**
+ *  fakesysfs.c - generator of fake coretemp and applesmc sysfs trees
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  Notes:
+ *    The layout follows a kernel >= 3.15 MacBook:
+ *      devices/platform/coretemp.0/hwmon/hwmon1/temp*
+ *      devices/platform/applesmc.768/fan*, temp1*
+ *      class/hwmon/hwmon{0,1} -> devices/platform/.../hwmon/hwmon{0,1}
+ *    Used by the tests and the benchmarks, never by the daemon itself.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include "fakesysfs.h"
+
+#define CORETEMP_DIR "devices/platform/coretemp.0/hwmon/hwmon1"
+#define APPLESMC_DIR "devices/platform/applesmc.768"
+
+static const char *fan_labels[] = {
+    "Left side", "Right side", "Exhaust", "Master", "Intake",
+    "Boost A", "Boost B", "PS", "PCI", "HDD"
+};
+
+static char *path_printf(const char *fmt, ...)
+{
+    char *buf = NULL;
+    va_list ap;
+
+    va_start(ap, fmt);
+    if (vasprintf(&buf, fmt, ap) < 0) {
+        buf = NULL;
+    }
+    va_end(ap);
+
+    return buf;
+}
+
+static int write_attribute(const char *root, const char *dir, const char *name, const char *value)
+{
+    char *path = path_printf("%s/%s/%s", root, dir, name);
+    FILE *file = fopen(path, "w");
+    free(path);
+
+    if (file == NULL) {
+        return -1;
+    }
+
+    fprintf(file, "%s\n", value);
+    fclose(file);
+    return 0;
+}
+
+static int write_int_attribute(const char *root, const char *dir, const char *name, int value)
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", value);
+    return write_attribute(root, dir, name, buf);
+}
+
+static int make_dirs(const char *root, const char *dir)
+{
+    char *path = path_printf("%s/%s", root, dir);
+
+    for (char *p = path + strlen(root) + 1; *p != '\0'; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            mkdir(path, 0755);
+            *p = '/';
+        }
+    }
+
+    int res = mkdir(path, 0755);
+    free(path);
+    return res;
+}
+
+static int make_link(const char *root, const char *target, const char *name)
+{
+    char *path = path_printf("%s/%s", root, name);
+    int res = symlink(target, path);
+    free(path);
+    return res;
+}
+
+char *fake_sysfs_create(int sensor_count, int fan_count)
+{
+    const char *tmpdir = getenv("TMPDIR");
+    char *root = path_printf("%s/mbpfan-sysfs.XXXXXX", tmpdir != NULL ? tmpdir : "/tmp");
+    int res = 0;
+
+    if (mkdtemp(root) == NULL) {
+        free(root);
+        return NULL;
+    }
+
+    res |= make_dirs(root, CORETEMP_DIR);
+    res |= make_dirs(root, APPLESMC_DIR "/hwmon/hwmon0");
+    res |= make_dirs(root, "class/hwmon");
+    res |= make_link(root, "../..", CORETEMP_DIR "/device");
+    res |= make_link(root, "../..", APPLESMC_DIR "/hwmon/hwmon0/device");
+    res |= make_link(root, "../../" APPLESMC_DIR "/hwmon/hwmon0", "class/hwmon/hwmon0");
+    res |= make_link(root, "../../" CORETEMP_DIR, "class/hwmon/hwmon1");
+
+    res |= write_attribute(root, CORETEMP_DIR, "name", "coretemp");
+
+    for (int i = 1; i <= sensor_count; i++) {
+        char name[32];
+        char label[32];
+
+        if (i == 1) {
+            snprintf(label, sizeof(label), "Package id 0");
+
+        } else {
+            snprintf(label, sizeof(label), "Core %d", i - 2);
+        }
+
+        snprintf(name, sizeof(name), "temp%d_input", i);
+        res |= write_int_attribute(root, CORETEMP_DIR, name, 45000);
+        snprintf(name, sizeof(name), "temp%d_label", i);
+        res |= write_attribute(root, CORETEMP_DIR, name, label);
+        snprintf(name, sizeof(name), "temp%d_max", i);
+        res |= write_int_attribute(root, CORETEMP_DIR, name, 86000);
+        snprintf(name, sizeof(name), "temp%d_max_alarm", i);
+        res |= write_int_attribute(root, CORETEMP_DIR, name, 0);
+        snprintf(name, sizeof(name), "temp%d_crit", i);
+        res |= write_int_attribute(root, CORETEMP_DIR, name, 100000);
+        snprintf(name, sizeof(name), "temp%d_crit_alarm", i);
+        res |= write_int_attribute(root, CORETEMP_DIR, name, 0);
+    }
+
+    res |= write_attribute(root, APPLESMC_DIR, "name", "applesmc");
+    // a single SMC key, enough to tell its sensors from the coretemp ones
+    res |= write_int_attribute(root, APPLESMC_DIR, "temp1_input", 40000);
+    res |= write_attribute(root, APPLESMC_DIR, "temp1_label", "TC0P");
+
+    for (int i = 1; i <= fan_count; i++) {
+        char name[32];
+        char label[32];
+
+        // applesmc pads the label read from the SMC
+        snprintf(label, sizeof(label), "%s ", fan_labels[(i - 1) % (sizeof(fan_labels) / sizeof(fan_labels[0]))]);
+
+        snprintf(name, sizeof(name), "fan%d_label", i);
+        res |= write_attribute(root, APPLESMC_DIR, name, label);
+        snprintf(name, sizeof(name), "fan%d_min", i);
+        res |= write_int_attribute(root, APPLESMC_DIR, name, 2000);
+        snprintf(name, sizeof(name), "fan%d_max", i);
+        res |= write_int_attribute(root, APPLESMC_DIR, name, 6200);
+        snprintf(name, sizeof(name), "fan%d_input", i);
+        res |= write_int_attribute(root, APPLESMC_DIR, name, 2000);
+        snprintf(name, sizeof(name), "fan%d_output", i);
+        res |= write_int_attribute(root, APPLESMC_DIR, name, 2000);
+        snprintf(name, sizeof(name), "fan%d_manual", i);
+        res |= write_int_attribute(root, APPLESMC_DIR, name, 0);
+    }
+
+    if (res != 0) {
+        fake_sysfs_destroy(root);
+        return NULL;
+    }
+
+    return root;
+}
+
+void fake_sysfs_set_temp(const char *root, int sensor, int millidegrees)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "temp%d_input", sensor);
+    write_int_attribute(root, CORETEMP_DIR, name, millidegrees);
+}
+
+void fake_sysfs_set_sensor(const char *root, int sensor, const char *attribute, int value)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "temp%d_%s", sensor, attribute);
+    write_int_attribute(root, CORETEMP_DIR, name, value);
+}
+
+int fake_sysfs_read_sensor(const char *root, int sensor, const char *attribute)
+{
+    char *path = path_printf("%s/" CORETEMP_DIR "/temp%d_%s", root, sensor, attribute);
+    FILE *file = fopen(path, "r");
+    int value = -1;
+    free(path);
+
+    if (file != NULL) {
+        if (fscanf(file, "%d", &value) != 1) {
+            value = -1;
+        }
+        fclose(file);
+    }
+
+    return value;
+}
+
+int fake_sysfs_read_fan(const char *root, int fan, const char *attribute)
+{
+    char *path = path_printf("%s/" APPLESMC_DIR "/fan%d_%s", root, fan, attribute);
+    FILE *file = fopen(path, "r");
+    int value = -1;
+    free(path);
+
+    if (file != NULL) {
+        if (fscanf(file, "%d", &value) != 1) {
+            value = -1;
+        }
+        fclose(file);
+    }
+
+    return value;
+}
+
+static int remove_entry(const char *path, const struct stat *sb, int flag, struct FTW *ftwbuf)
+{
+    (void)sb;
+    (void)flag;
+    (void)ftwbuf;
+    return remove(path);
+}
+
+void fake_sysfs_destroy(char *root)
+{
+    if (root == NULL) {
+        return;
+    }
+
+    nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    free(root);
+}
@@ -0,0 +1,55 @@
+/**
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _FAKESYSFS_H_
+#define _FAKESYSFS_H_
+
+/**
+ * Build a fake sysfs tree in a new temporary directory with a coretemp
+ * device holding sensor_count temperature inputs (temp1 is the package,
+ * the others are cores) and an applesmc device holding fan_count fans
+ * and one temperature input.
+ * Both are linked from class/hwmon like on a real MacBook.
+ * Return the root of the tree, to be passed to set_sysfs_root(),
+ * or NULL on failure
+ */
+char *fake_sysfs_create(int sensor_count, int fan_count);
+
+/**
+ * Set the value of tempN_input (1-based) of the fake coretemp device
+ */
+void fake_sysfs_set_temp(const char *root, int sensor, int millidegrees);
+
+/**
+ * Set tempN_<attribute> (1-based) of the fake coretemp device, like max_alarm
+ */
+void fake_sysfs_set_sensor(const char *root, int sensor, const char *attribute, int value);
+
+/**
+ * Return the value of tempN_<attribute> (1-based) of the fake coretemp
+ * device, -1 if it can not be read
+ */
+int fake_sysfs_read_sensor(const char *root, int sensor, const char *attribute);
+
+/**
+ * Return the value of fanN_<attribute> (1-based) of the fake applesmc
+ * device, -1 if it can not be read
+ */
+int fake_sysfs_read_fan(const char *root, int fan, const char *attribute);
+
+/**
+ * Delete the tree and free root
+ */
+void fake_sysfs_destroy(char *root);
+
+#endif
@@ -0,0 +1,101 @@
+/**
+ *  filter.c - noise filtering of the sensor readings
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  Notes:
+ *    coretemp moves in 1C steps and spikes for a few ms. The median of a
+ *    few reads per poll drops the spikes, the Kalman filter smooths the
+ *    steps and estimates the rate of rise used by the PID derivative.
+ *    The model is x = [temp, rate] with x' = [temp + rate * dt, rate]
+ *    and the rate following a random walk of filter_process_noise.
+ */
+
+#include <string.h>
+#include "filter.h"
+
+int filter_oversample = 1;
+float filter_process_noise = 0.01;
+float filter_measurement_noise = 0;
+
+int median_of(int *values, int count)
+{
+    // insertion sort, count is at most FILTER_MAX_OVERSAMPLE
+    for (int i = 1; i < count; i++) {
+        const int value = values[i];
+        int j = i - 1;
+
+        while (j >= 0 && values[j] > value) {
+            values[j + 1] = values[j];
+            j--;
+        }
+
+        values[j + 1] = value;
+    }
+
+    return values[count / 2];
+}
+
+bool kalman_enabled()
+{
+    return filter_measurement_noise > 0;
+}
+
+void kalman_init(t_kalman *kalman)
+{
+    memset(kalman, 0, sizeof(*kalman));
+}
+
+float kalman_update(t_kalman *kalman, double time, float measurement)
+{
+    const float r = filter_measurement_noise;
+    float (*p)[2] = kalman->p;
+
+    if (!kalman->started) {
+        kalman->temp = measurement;
+        kalman->rate = 0;
+        p[0][0] = r;
+        p[0][1] = p[1][0] = 0;
+        p[1][1] = 1;
+        kalman->time = time;
+        kalman->started = true;
+        return kalman->temp;
+    }
+
+    // Predict
+    const float dt = time - kalman->time;
+    const float q = filter_process_noise;
+    kalman->time = time;
+
+    kalman->temp += kalman->rate * dt;
+
+    const float p00 = p[0][0] + dt * (p[1][0] + p[0][1]) + dt * dt * p[1][1] + q * dt * dt * dt / 3;
+    const float p01 = p[0][1] + dt * p[1][1] + q * dt * dt / 2;
+    const float p10 = p[1][0] + dt * p[1][1] + q * dt * dt / 2;
+    const float p11 = p[1][1] + q * dt;
+
+    // Update
+    const float s = p00 + r;
+    const float k0 = p00 / s;
+    const float k1 = p10 / s;
+    const float error = measurement - kalman->temp;
+
+    kalman->temp += k0 * error;
+    kalman->rate += k1 * error;
+
+    p[0][0] = (1 - k0) * p00;
+    p[0][1] = (1 - k0) * p01;
+    p[1][0] = p10 - k1 * p00;
+    p[1][1] = p11 - k1 * p01;
+
+    return kalman->temp;
+}
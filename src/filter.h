@@ -0,0 +1,63 @@
+/**
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _FILTER_H_
+#define _FILTER_H_
+
+#include <stdbool.h>
+
+// Most reads of each sensor per poll
+#define FILTER_MAX_OVERSAMPLE 9
+// Delay between two reads of a sensor, longer than a spike so the next read misses it
+#define FILTER_OVERSAMPLE_GAP_MS 5
+
+/** Noise filtering settings
+ *  filter_oversample - reads of each sensor per poll, their median is used
+ *  filter_process_noise - variance of the change of the rate of rise, in (C/s)^2 per s
+ *  filter_measurement_noise - variance of a reading in C^2, 0 disables the Kalman filter
+ */
+extern int filter_oversample;
+extern float filter_process_noise;
+extern float filter_measurement_noise;
+
+/**
+ * Return the median of count values, reordering them
+ */
+int median_of(int *values, int count);
+
+/** Scalar Kalman filter with a constant rate of rise model
+ *  temp, rate - estimated temperature in C and its rate of change in C/s
+ *  p - covariance of the estimate
+ *  time - time of the last update in seconds
+ */
+typedef struct {
+    float temp;
+    float rate;
+    float p[2][2];
+    double time;
+    bool started;
+} t_kalman;
+
+/**
+ * Return true if filter_measurement_noise enables the Kalman filter
+ */
+bool kalman_enabled();
+
+void kalman_init(t_kalman *kalman);
+
+/**
+ * Feed a reading taken at time seconds, return the estimated temperature
+ */
+float kalman_update(t_kalman *kalman, double time, float measurement);
+
+#endif
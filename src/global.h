@@ -7,16 +7,27 @@ extern int verbose;
 extern const char* PROGRAM_NAME;
 extern const char* PROGRAM_PID;
 
+// Configuration file given with -c, NULL for /etc/mbpfan.conf
+extern const char* settings_path;
+
 struct s_sensors {
     FILE* file;
     char* path;
+    char* label;            // tempN_label, or tempN
+    char* driver;           // hwmon name of the sensor
+    float weight;           // from sensor_weights, 0 ignores the sensor
     unsigned int temperature;
+    int alarm_fd;           // tempN_max_alarm, -1 if the driver has none or alarms are off
+    FILE* threshold_file;   // matching tempN_max, NULL if read-only
+    int alarm_threshold;    // last value written to threshold_file, 0 if it holds the original
+    int threshold_original; // tempN_max in millidegrees before the daemon touched it
     struct s_sensors *next;
 };
 
 struct s_fans {
     char* name;
     FILE* file;
+    int manual_fd;  // fan#_manual, -1 if it could not be opened
     char* path;  // TODO: unused
     char* fan_output_path;
     char* fan_manual_path;
@@ -25,6 +36,9 @@ struct s_fans {
     int max_speed;
     int min_speed;
     int fan_id; // applesmc.768/fan#_*
+    long last_write_ms;  // when old_speed was written
+    unsigned long writes;
+    unsigned long suppressed;
     struct s_fans *next;
 };
 
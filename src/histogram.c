@@ -0,0 +1,89 @@
+/**
+ *  histogram.c - fixed memory log-bucketed histograms
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <string.h>
+#include "histogram.h"
+
+static int bucket_of(uint64_t value)
+{
+    if (value < HISTOGRAM_LINEAR) {
+        return value;
+    }
+
+    int msb = 63 - __builtin_clzll(value);
+
+    if (msb >= HISTOGRAM_MAX_BITS) {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+
+    // the 3 bits below the most significant one select the sub bucket
+    const int shift = msb - 3;
+    const int mantissa = (value >> shift) - HISTOGRAM_SUB_BUCKETS;
+
+    return HISTOGRAM_LINEAR + (msb - 4) * HISTOGRAM_SUB_BUCKETS + mantissa;
+}
+
+uint64_t histogram_bucket_limit(int bucket)
+{
+    if (bucket < HISTOGRAM_LINEAR) {
+        return bucket;
+    }
+
+    const int msb = (bucket - HISTOGRAM_LINEAR) / HISTOGRAM_SUB_BUCKETS + 4;
+    const uint64_t mantissa = (bucket - HISTOGRAM_LINEAR) % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS;
+
+    return ((mantissa + 1) << (msb - 3)) - 1;
+}
+
+void histogram_reset(t_histogram *histogram)
+{
+    memset(histogram, 0, sizeof(*histogram));
+}
+
+void histogram_record(t_histogram *histogram, uint64_t value)
+{
+    histogram->counts[bucket_of(value)]++;
+    histogram->total++;
+    histogram->sum += value;
+
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+uint64_t histogram_percentile(const t_histogram *histogram, double fraction)
+{
+    if (histogram->total == 0) {
+        return 0;
+    }
+
+    uint64_t rank = fraction * histogram->total;
+    uint64_t seen = 0;
+
+    if (rank >= histogram->total) {
+        return histogram->max;
+    }
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->counts[i];
+
+        if (seen > rank) {
+            const uint64_t limit = histogram_bucket_limit(i);
+            return limit < histogram->max ? limit : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
@@ -0,0 +1,53 @@
+/**
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <stdint.h>
+
+// Values below HISTOGRAM_LINEAR get a bucket each
+#define HISTOGRAM_LINEAR 16
+// Every power of two above is split in HISTOGRAM_SUB_BUCKETS (12.5% precision)
+#define HISTOGRAM_SUB_BUCKETS 8
+// Largest power of two tracked, 2^40 ns is about 18 minutes
+#define HISTOGRAM_MAX_BITS 40
+#define HISTOGRAM_BUCKETS (HISTOGRAM_LINEAR + (HISTOGRAM_MAX_BITS - 4) * HISTOGRAM_SUB_BUCKETS)
+
+/** Fixed size log-bucketed histogram (HDR style)
+ *  Recording is O(1) and never allocates, larger values are clamped
+ *  into the last bucket but max stays exact
+ */
+typedef struct {
+    uint32_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max;
+} t_histogram;
+
+void histogram_reset(t_histogram *histogram);
+
+void histogram_record(t_histogram *histogram, uint64_t value);
+
+/**
+ * Return the value below which the given fraction (0 to 1) of the
+ * recorded values falls, rounded up to the end of its bucket
+ */
+uint64_t histogram_percentile(const t_histogram *histogram, double fraction);
+
+/**
+ * Return the largest value of the given bucket
+ */
+uint64_t histogram_bucket_limit(int bucket);
+
+#endif
@@ -0,0 +1,163 @@
+/**
+ *  history.c - sample history with incremental statistics
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  Notes:
+ *    The window sums are updated by adding the new sample and removing
+ *    the one leaving the window. Times are kept relative to an origin
+ *    that is moved to the oldest sample of the window once they grow
+ *    large, so the sums of squares do not lose precision.
+ */
+
+#include <string.h>
+#include "history.h"
+
+#define REBASE_AFTER 3600.0 // seconds
+
+#define SLOT(seq) ((seq) % HISTORY_SIZE)
+
+void history_init(t_history *history, int window)
+{
+    memset(history, 0, sizeof(*history));
+
+    if (window < 2) window = 2;
+    if (window > HISTORY_SIZE) window = HISTORY_SIZE;
+
+    history->window = window;
+    history->ema_alpha = 2.0 / (window + 1);
+}
+
+int history_len(const t_history *history)
+{
+    return history->count < (uint64_t)history->window ? (int)history->count : history->window;
+}
+
+static void sums_add(t_history *history, uint64_t seq, double sign)
+{
+    const double t = history->time[SLOT(seq)] - history->origin;
+    const double v = history->value[SLOT(seq)];
+
+    history->sum_t += sign * t;
+    history->sum_v += sign * v;
+    history->sum_tt += sign * t * t;
+    history->sum_tv += sign * t * v;
+}
+
+static void rebase(t_history *history)
+{
+    const uint64_t first = history->count - history_len(history);
+
+    history->origin = history->time[SLOT(first)];
+    history->sum_t = history->sum_v = history->sum_tt = history->sum_tv = 0;
+
+    for (uint64_t seq = first; seq < history->count; seq++) {
+        sums_add(history, seq, 1);
+    }
+}
+
+// Drop candidates that can no longer be the extreme, then append seq
+static void deque_push(const t_history *history, uint64_t *deque, int *head, int *len,
+                       uint64_t seq, int sign)
+{
+    const float value = history->value[SLOT(seq)];
+    const uint64_t first = seq + 1 - history_len(history);
+
+    while (*len > 0 && deque[*head] < first) {
+        *head = (*head + 1) % HISTORY_SIZE;
+        (*len)--;
+    }
+
+    while (*len > 0 &&
+           sign * history->value[SLOT(deque[(*head + *len - 1) % HISTORY_SIZE])] <= sign * value) {
+        (*len)--;
+    }
+
+    deque[(*head + *len) % HISTORY_SIZE] = seq;
+    (*len)++;
+}
+
+void history_push(t_history *history, double time, float value)
+{
+    const uint64_t seq = history->count;
+
+    if (history->count >= (uint64_t)history->window) {
+        sums_add(history, seq - history->window, -1);
+    }
+
+    if (history->count == 0) {
+        history->origin = time;
+        history->ema = value;
+    } else {
+        history->ema += history->ema_alpha * (value - history->ema);
+    }
+
+    history->time[SLOT(seq)] = time;
+    history->value[SLOT(seq)] = value;
+    history->count++;
+
+    sums_add(history, seq, 1);
+
+    if (time - history->origin > REBASE_AFTER) {
+        rebase(history);
+    }
+
+    deque_push(history, history->min_seq, &history->min_head, &history->min_len, seq, -1);
+    deque_push(history, history->max_seq, &history->max_head, &history->max_len, seq, 1);
+}
+
+float history_last(const t_history *history)
+{
+    return history->count > 0 ? history->value[SLOT(history->count - 1)] : 0;
+}
+
+double history_interval(const t_history *history)
+{
+    if (history->count < 2) {
+        return 0;
+    }
+
+    return history->time[SLOT(history->count - 1)] - history->time[SLOT(history->count - 2)];
+}
+
+float history_slope(const t_history *history)
+{
+    const int n = history_len(history);
+
+    if (n < 2) {
+        return 0;
+    }
+
+    const double denominator = n * history->sum_tt - history->sum_t * history->sum_t;
+
+    if (denominator <= 0) {
+        return 0;
+    }
+
+    return (n * history->sum_tv - history->sum_t * history->sum_v) / denominator;
+}
+
+float history_mean(const t_history *history)
+{
+    const int n = history_len(history);
+    return n > 0 ? history->sum_v / n : 0;
+}
+
+float history_min(const t_history *history)
+{
+    return history->min_len > 0 ? history->value[SLOT(history->min_seq[history->min_head])] : 0;
+}
+
+float history_max(const t_history *history)
+{
+    return history->max_len > 0 ? history->value[SLOT(history->max_seq[history->max_head])] : 0;
+}
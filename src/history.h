@@ -0,0 +1,86 @@
+/**
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include <stdint.h>
+
+// Samples kept, the largest usable window
+#define HISTORY_SIZE 64
+
+/** Ring buffer of timestamped samples with statistics over the last
+ *  window samples, all updated in O(1) (amortized for min/max) per sample
+ *  time, value - seconds and degrees, indexed by sequence % HISTORY_SIZE
+ *  ema - exponential moving average with a span of window samples
+ *  sum_* - least squares sums over the window, times relative to origin
+ *  min_seq, max_seq - monotonic deques of the sequences of the window
+ *                     minimum and maximum candidates
+ */
+typedef struct {
+    double time[HISTORY_SIZE];
+    float value[HISTORY_SIZE];
+    uint64_t count;
+    int window;
+
+    float ema;
+    float ema_alpha;
+
+    double origin;
+    double sum_t;
+    double sum_v;
+    double sum_tt;
+    double sum_tv;
+
+    uint64_t min_seq[HISTORY_SIZE];
+    uint64_t max_seq[HISTORY_SIZE];
+    int min_head, min_len;
+    int max_head, max_len;
+} t_history;
+
+/**
+ * Start an empty history computing its statistics over window samples,
+ * at most HISTORY_SIZE
+ */
+void history_init(t_history *history, int window);
+
+/**
+ * Add a sample taken at time seconds (any monotonic origin)
+ */
+void history_push(t_history *history, double time, float value);
+
+/**
+ * Number of samples in the window
+ */
+int history_len(const t_history *history);
+
+/**
+ * Latest sample, and seconds between the two latest samples (0 if fewer)
+ */
+float history_last(const t_history *history);
+double history_interval(const t_history *history);
+
+/**
+ * Least squares slope over the window in degrees per second, 0 if fewer
+ * than 2 samples
+ */
+float history_slope(const t_history *history);
+
+/**
+ * Mean, minimum and maximum over the window, 0 if empty
+ */
+float history_mean(const t_history *history);
+float history_min(const t_history *history);
+float history_max(const t_history *history);
+
+#endif
@@ -0,0 +1,246 @@
+/**
+ *  hwmon.c - discovery of temperature sensors under /sys/class/hwmon
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  Notes:
+ *    Each hwmon device costs one read of its name attribute and one
+ *    directory read. Drivers predating kernel 3.15 keep their attributes
+ *    on the parent device, so hwmonN/device is read when hwmonN has none.
+ *    applesmc keeps its temperatures next to its fans, they are indexed
+ *    after every other driver so MAX_SENSORS is never filled by the SMC.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <stdbool.h>
+#include "hwmon.h"
+
+const char *hwmon_drivers[] = { "coretemp", "applesmc", "k10temp", "nvme", "amdgpu", NULL };
+
+static bool read_attribute(const char *path, char *buf, size_t size)
+{
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL) {
+        return false;
+    }
+
+    size_t len = fread(buf, 1, size - 1, file);
+    fclose(file);
+
+    // Remove trailing spaces
+    while (len > 0 && isspace((unsigned char)buf[len - 1])) {
+        len--;
+    }
+
+    buf[len] = '\0';
+    return len > 0;
+}
+
+static bool known_driver(const char *name)
+{
+    for (int i = 0; hwmon_drivers[i] != NULL; i++) {
+        if (strcmp(hwmon_drivers[i], name) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Add the tempN_input files of dir to the index, return how many were found */
+static int index_temperatures(t_hwmon_index *index, const char *dir, const char *driver)
+{
+    struct dirent **entries;
+    int count = scandir(dir, &entries, NULL, versionsort);
+
+    if (count < 0) {
+        return 0;
+    }
+
+    bool has_label[MAX_SENSORS + 1];
+    memset(has_label, 0, sizeof(has_label));
+
+    for (int i = 0; i < count; i++) {
+        int n, end = 0;
+
+        if (sscanf(entries[i]->d_name, "temp%d_label%n", &n, &end) == 1 &&
+            entries[i]->d_name[end] == '\0' && n > 0 && n <= MAX_SENSORS) {
+            has_label[n] = true;
+        }
+    }
+
+    int found = 0;
+
+    for (int i = 0; i < count; i++) {
+        int n, end = 0;
+
+        if (sscanf(entries[i]->d_name, "temp%d_input%n", &n, &end) == 1 &&
+            entries[i]->d_name[end] == '\0' && n > 0 && n <= MAX_SENSORS &&
+            index->sensor_count < MAX_SENSORS) {
+
+            t_hwmon_sensor *sensor = &index->sensors[index->sensor_count++];
+            sensor->driver = strdup(driver);
+            sensor->index = n;
+            sensor->input_path = smprintf("%s/%s", dir, entries[i]->d_name);
+            sensor->label = NULL;
+
+            if (has_label[n]) {
+                char label[64];
+                char *path = smprintf("%s/temp%d_label", dir, n);
+
+                if (read_attribute(path, label, sizeof(label))) {
+                    sensor->label = strdup(label);
+                }
+
+                free(path);
+            }
+
+            if (sensor->label == NULL) {
+                sensor->label = smprintf("temp%d", n);
+            }
+
+            found++;
+        }
+
+        free(entries[i]);
+    }
+
+    free(entries);
+    return found;
+}
+
+/* Return true if dir holds the applesmc fan attributes */
+static bool has_fans(const char *dir)
+{
+    char *path = smprintf("%s/fan1_output", dir);
+    FILE *file = fopen(path, "r");
+    free(path);
+
+    if (file != NULL) {
+        fclose(file);
+        return true;
+    }
+
+    return false;
+}
+
+bool hwmon_discover(const char *root, t_hwmon_index *index)
+{
+    memset(index, 0, sizeof(*index));
+
+    char *class_path = smprintf("%s/class/hwmon", root);
+    struct dirent **entries;
+    int count = scandir(class_path, &entries, NULL, versionsort);
+
+    if (count < 0) {
+        free(class_path);
+        return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (strncmp(entries[i]->d_name, "hwmon", strlen("hwmon")) != 0) {
+            free(entries[i]);
+            continue;
+        }
+
+        char name[64];
+        char *dir = smprintf("%s/%s", class_path, entries[i]->d_name);
+        char *device_dir = smprintf("%s/device", dir);
+        char *name_path = smprintf("%s/name", dir);
+
+        if (!read_attribute(name_path, name, sizeof(name))) {
+            // pre 3.15 drivers put name on the parent device
+            free(name_path);
+            name_path = smprintf("%s/name", device_dir);
+
+            if (!read_attribute(name_path, name, sizeof(name))) {
+                name[0] = '\0';
+            }
+        }
+
+        if (known_driver(name)) {
+            // applesmc temperatures are indexed last, see below
+            if (strcmp(name, "applesmc") == 0) {
+                if (index->applesmc_path == NULL) {
+                    if (has_fans(dir)) {
+                        index->applesmc_path = strdup(dir);
+
+                    } else if (has_fans(device_dir)) {
+                        index->applesmc_path = strdup(device_dir);
+                    }
+                }
+
+            } else if (index_temperatures(index, dir, name) == 0) {
+                index_temperatures(index, device_dir, name);
+            }
+        }
+
+        free(name_path);
+        free(device_dir);
+        free(dir);
+        free(entries[i]);
+    }
+
+    free(entries);
+    free(class_path);
+
+    // the SMC exposes dozens of temperatures, they must not crowd out the CPU ones
+    if (index->applesmc_path != NULL) {
+        index_temperatures(index, index->applesmc_path, "applesmc");
+    }
+
+    return true;
+}
+
+void hwmon_free(t_hwmon_index *index)
+{
+    for (int i = 0; i < index->sensor_count; i++) {
+        free(index->sensors[i].driver);
+        free(index->sensors[i].input_path);
+        free(index->sensors[i].label);
+    }
+
+    free(index->applesmc_path);
+    memset(index, 0, sizeof(*index));
+}
+
+bool hwmon_driver_listed(const char *list, const char *name)
+{
+    const size_t len = strlen(name);
+    const char *item = list;
+
+    while (item != NULL && *item != '\0') {
+        while (isspace((unsigned char)*item)) {
+            item++;
+        }
+
+        if (strncmp(item, name, len) == 0 &&
+            (item[len] == '\0' || item[len] == ',' || isspace((unsigned char)item[len]))) {
+            return true;
+        }
+
+        item = strchr(item, ',');
+
+        if (item != NULL) {
+            item++;
+        }
+    }
+
+    return false;
+}
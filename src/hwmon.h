@@ -0,0 +1,67 @@
+/**
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _HWMON_H_
+#define _HWMON_H_
+
+#include <stdbool.h>
+#include "mbpfan.h"
+
+/** A temperature input found under /sys/class/hwmon
+ *  driver - contents of the hwmon "name" attribute
+ *  input_path - full path of tempN_input
+ *  label - contents of tempN_label, or "tempN" if the driver has none
+ */
+typedef struct {
+    char *driver;
+    char *input_path;
+    char *label;
+    int index;
+} t_hwmon_sensor;
+
+/** Result of a discovery pass
+ *  sensors - temperature inputs of every known driver, by hwmon device and
+ *            index, those of applesmc last
+ *  applesmc_path - directory holding the applesmc fanN_* and tempN_* files,
+ *                  NULL if absent
+ */
+typedef struct {
+    t_hwmon_sensor sensors[MAX_SENSORS];
+    int sensor_count;
+    char *applesmc_path;
+} t_hwmon_index;
+
+/**
+ * NULL terminated list of the hwmon drivers indexed by hwmon_discover()
+ */
+extern const char *hwmon_drivers[];
+
+/**
+ * Enumerate <root>/class/hwmon once, match each device by its name
+ * attribute and index the temperature inputs of known drivers.
+ * root is normally "/sys"
+ * Return false if <root>/class/hwmon could not be read
+ */
+bool hwmon_discover(const char *root, t_hwmon_index *index);
+
+/**
+ * Release the memory held by an index
+ */
+void hwmon_free(t_hwmon_index *index);
+
+/**
+ * Return true if name is an element of the comma-delimited list
+ */
+bool hwmon_driver_listed(const char *list, const char *name);
+
+#endif
@@ -0,0 +1,610 @@
+/**
+ *  journal.c - compact on-disk ring of the control loop ticks
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  Notes:
+ *    The file is a header block followed by a ring of fixed size blocks,
+ *    each tagged with an increasing sequence number, so the oldest block
+ *    is simply overwritten when the ring is full. A block starts with a
+ *    full record (a keyframe) and the following records only hold what
+ *    changed since the previous one, as varints:
+ *      zigzag(time delta - previous time delta) << 1 | changed
+ *      if changed: a bitmap of the changed fields, then zigzag(delta) of each
+ *    The fields are the driving temperature, the base speed, the sensors
+ *    and the fans. A tick of a steady machine polled at a steady rate is
+ *    a single byte. The record length is published after the record, the
+ *    sequence after the keyframe, so a reader never decodes a torn record.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "global.h"
+#include "mbpfan.h"
+#include "aggregate.h"
+#include "journal.h"
+
+#define JOURNAL_FIELDS (2 + MAX_SENSORS + MAX_FANS)
+// Longest encoding of a record: varints of 64 bit values and of 33 bit deltas
+#define JOURNAL_RECORD_MAX (10 + 10 + (JOURNAL_FIELDS + 7) / 8 + 5 * JOURNAL_FIELDS)
+
+char journal_path[108] = "";
+int journal_size = 8192;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint32_t block_count;
+} t_journal_header;
+
+/** Header of each block of the ring
+ *  sequence - 0 while the block is unused or being restarted
+ *  used - bytes of records following the header
+ *  sensor_count, fan_count - of every record of the block
+ */
+typedef struct {
+    uint64_t sequence;
+    uint32_t used;
+    uint16_t sensor_count;
+    uint16_t fan_count;
+} t_journal_block;
+
+#define JOURNAL_BLOCK_DATA (JOURNAL_BLOCK_SIZE - sizeof(t_journal_block))
+
+// State shared by the encoder and the decoder: the previous record of the block
+typedef struct {
+    t_journal_record last;
+    int64_t interval;
+} t_journal_state;
+
+static struct {
+    uint8_t *map;
+    size_t size;
+    uint32_t block_count;
+    uint32_t block;
+    uint64_t sequence;
+    bool started;
+    t_journal_state state;
+} journal = { .map = NULL };
+
+static size_t put_varint(uint8_t *out, uint64_t value)
+{
+    size_t length = 0;
+
+    while (value >= 0x80) {
+        out[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+
+    out[length++] = (uint8_t)value;
+    return length;
+}
+
+static bool get_varint(const uint8_t **in, const uint8_t *end, uint64_t *value)
+{
+    uint64_t result = 0;
+
+    for (int shift = 0; shift < 64 && *in < end; shift += 7) {
+        const uint8_t byte = *(*in)++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static uint64_t zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static int get_fields(const t_journal_record *record, int32_t *fields)
+{
+    fields[0] = record->temp;
+    fields[1] = record->fan_speed;
+    memcpy(fields + 2, record->sensor_temp, record->sensor_count * sizeof(fields[0]));
+    memcpy(fields + 2 + record->sensor_count, record->fan_target, record->fan_count * sizeof(fields[0]));
+    return 2 + record->sensor_count + record->fan_count;
+}
+
+static void set_fields(t_journal_record *record, const int32_t *fields)
+{
+    record->temp = fields[0];
+    record->fan_speed = fields[1];
+    memcpy(record->sensor_temp, fields + 2, record->sensor_count * sizeof(fields[0]));
+    memcpy(record->fan_target, fields + 2 + record->sensor_count, record->fan_count * sizeof(fields[0]));
+}
+
+// Encode record after state->last, or as a keyframe if state is NULL
+static size_t encode(const t_journal_state *state, const t_journal_record *record, uint8_t *out)
+{
+    int32_t fields[JOURNAL_FIELDS];
+    const int count = get_fields(record, fields);
+    size_t length = 0;
+
+    if (state == NULL) {
+        length += put_varint(out, record->time_ms);
+
+        for (int i = 0; i < count; i++) {
+            length += put_varint(out + length, zigzag(fields[i]));
+        }
+
+        return length;
+    }
+
+    int32_t previous[JOURNAL_FIELDS];
+    get_fields(&state->last, previous);
+
+    uint8_t changed[(JOURNAL_FIELDS + 7) / 8];
+    const int changed_size = (count + 7) / 8;
+    bool any = false;
+    memset(changed, 0, sizeof(changed));
+
+    for (int i = 0; i < count; i++) {
+        if (fields[i] != previous[i]) {
+            changed[i / 8] |= 1 << (i % 8);
+            any = true;
+        }
+    }
+
+    const int64_t interval = (int64_t)(record->time_ms - state->last.time_ms);
+    length += put_varint(out, zigzag(interval - state->interval) << 1 | any);
+
+    if (any) {
+        memcpy(out + length, changed, changed_size);
+        length += changed_size;
+
+        for (int i = 0; i < count; i++) {
+            if (fields[i] != previous[i]) {
+                length += put_varint(out + length, zigzag((int64_t)fields[i] - previous[i]));
+            }
+        }
+    }
+
+    return length;
+}
+
+// Decode the record at *in after state->last, or a keyframe if first
+static bool decode(t_journal_state *state, bool first, const uint8_t **in, const uint8_t *end)
+{
+    t_journal_record *record = &state->last;
+    int32_t fields[JOURNAL_FIELDS];
+    const int count = get_fields(record, fields);
+    uint64_t value;
+
+    if (first) {
+        if (!get_varint(in, end, &record->time_ms)) {
+            return false;
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (!get_varint(in, end, &value)) {
+                return false;
+            }
+            fields[i] = (int32_t)unzigzag(value);
+        }
+
+        state->interval = 0;
+        set_fields(record, fields);
+        return true;
+    }
+
+    if (!get_varint(in, end, &value)) {
+        return false;
+    }
+
+    state->interval += unzigzag(value >> 1);
+    record->time_ms += state->interval;
+
+    if (value & 1) {
+        const uint8_t *changed = *in;
+        const int changed_size = (count + 7) / 8;
+
+        if (end - *in < changed_size) {
+            return false;
+        }
+
+        *in += changed_size;
+
+        for (int i = 0; i < count; i++) {
+            if (changed[i / 8] & (1 << (i % 8))) {
+                if (!get_varint(in, end, &value)) {
+                    return false;
+                }
+                fields[i] += (int32_t)unzigzag(value);
+            }
+        }
+
+        set_fields(record, fields);
+    }
+
+    return true;
+}
+
+static t_journal_block *block_at(uint8_t *map, uint32_t index)
+{
+    return (t_journal_block *)(map + (size_t)(index + 1) * JOURNAL_BLOCK_SIZE);
+}
+
+// Restart the next block of the ring with record as its keyframe
+static void start_block(const t_journal_record *record)
+{
+    t_journal_block *block = block_at(journal.map, journal.block);
+    uint8_t *data = (uint8_t *)(block + 1);
+
+    __atomic_store_n(&block->sequence, 0, __ATOMIC_RELEASE);
+    block->used = encode(NULL, record, data);
+    block->sensor_count = record->sensor_count;
+    block->fan_count = record->fan_count;
+    __atomic_store_n(&block->sequence, journal.sequence++, __ATOMIC_RELEASE);
+
+    journal.state.last = *record;
+    journal.state.interval = 0;
+    journal.started = true;
+}
+
+void journal_append(const t_journal_record *record)
+{
+    if (journal.map == NULL) {
+        return;
+    }
+
+    t_journal_block *block = block_at(journal.map, journal.block);
+
+    if (journal.started && block->sensor_count == record->sensor_count &&
+        block->fan_count == record->fan_count) {
+        uint8_t buffer[JOURNAL_RECORD_MAX];
+        const size_t length = encode(&journal.state, record, buffer);
+
+        if (block->used + length <= JOURNAL_BLOCK_DATA) {
+            memcpy((uint8_t *)(block + 1) + block->used, buffer, length);
+            __atomic_store_n(&block->used, block->used + length, __ATOMIC_RELEASE);
+
+            journal.state.interval = (int64_t)(record->time_ms - journal.state.last.time_ms);
+            journal.state.last = *record;
+            return;
+        }
+    }
+
+    if (journal.started) {
+        journal.block = (journal.block + 1) % journal.block_count;
+    }
+
+    start_block(record);
+}
+
+void journal_publish(float temp, int fan_speed)
+{
+    if (journal.map == NULL) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    t_journal_record record;
+    record.time_ms = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    record.temp = lroundf(temp * 1000);
+    record.fan_speed = fan_speed;
+
+    record.sensor_count = sensor_samples.count;
+    for (int i = 0; i < sensor_samples.count; i++) {
+        record.sensor_temp[i] = sensor_samples.temp[i];
+    }
+
+    int count = 0;
+    for (t_fans *fan = fans; fan != NULL && count < MAX_FANS; fan = fan->next) {
+        record.fan_target[count++] = fan->old_speed;
+    }
+    record.fan_count = count;
+
+    journal_append(&record);
+}
+
+static bool header_valid(const t_journal_header *header, off_t file_size)
+{
+    return header->magic == JOURNAL_MAGIC && header->version == JOURNAL_VERSION &&
+           header->block_size == JOURNAL_BLOCK_SIZE && header->block_count > 0 &&
+           file_size == (off_t)(header->block_count + 1) * JOURNAL_BLOCK_SIZE;
+}
+
+bool journal_open(const char *path, size_t size)
+{
+    if (size < JOURNAL_MIN_SIZE) {
+        errno = EINVAL;
+        return false;
+    }
+
+    const uint32_t block_count = size / JOURNAL_BLOCK_SIZE - 1;
+    const off_t file_size = (off_t)(block_count + 1) * JOURNAL_BLOCK_SIZE;
+    const int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+    if (fd == -1) {
+        return false;
+    }
+
+    t_journal_header header;
+    struct stat st;
+    bool valid = fstat(fd, &st) == 0 && pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+                 header_valid(&header, st.st_size) && header.block_count == block_count;
+
+    // start over with a sparse, zeroed file
+    if (!valid && (ftruncate(fd, 0) == -1 || ftruncate(fd, file_size) == -1)) {
+        const int saved = errno;
+        close(fd);
+        errno = saved;
+        return false;
+    }
+
+    void *map = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    journal.map = map;
+    journal.size = file_size;
+    journal.block_count = block_count;
+    journal.block = 0;
+    journal.sequence = 1;
+    journal.started = false;
+
+    if (valid) {
+        // resume after the newest block
+        for (uint32_t i = 0; i < block_count; i++) {
+            const uint64_t sequence = block_at(journal.map, i)->sequence;
+
+            if (sequence >= journal.sequence) {
+                journal.sequence = sequence + 1;
+                journal.block = (i + 1) % block_count;
+            }
+        }
+    } else {
+        header.magic = JOURNAL_MAGIC;
+        header.version = JOURNAL_VERSION;
+        header.block_size = JOURNAL_BLOCK_SIZE;
+        header.block_count = block_count;
+        memcpy(journal.map, &header, sizeof(header));
+    }
+
+    if (verbose) {
+        LOG("Journaling the ticks in %s (%u blocks)", path, block_count);
+    }
+
+    return true;
+}
+
+void journal_close()
+{
+    if (journal.map == NULL) {
+        return;
+    }
+
+    munmap(journal.map, journal.size);
+    journal.map = NULL;
+}
+
+typedef struct {
+    uint64_t sequence;
+    uint32_t index;
+} t_block_order;
+
+static int compare_blocks(const void *a, const void *b)
+{
+    const uint64_t left = ((const t_block_order *)a)->sequence;
+    const uint64_t right = ((const t_block_order *)b)->sequence;
+    return left < right ? -1 : left > right;
+}
+
+// Decode a copy of a block. Return the number of records, -1 if the visitor stopped
+static long read_block(const uint8_t *copy, t_journal_visitor visitor, void *data)
+{
+    const t_journal_block *block = (const t_journal_block *)copy;
+
+    if (block->used > JOURNAL_BLOCK_DATA || block->sensor_count > MAX_SENSORS ||
+        block->fan_count > MAX_FANS) {
+        return 0;
+    }
+
+    t_journal_state state;
+    memset(&state, 0, sizeof(state));
+    state.last.sensor_count = block->sensor_count;
+    state.last.fan_count = block->fan_count;
+
+    const uint8_t *in = (const uint8_t *)(block + 1);
+    const uint8_t *end = in + block->used;
+    long count = 0;
+
+    while (in < end && decode(&state, count == 0, &in, end)) {
+        count++;
+
+        if (!visitor(&state.last, data)) {
+            return -1;
+        }
+    }
+
+    return count;
+}
+
+long journal_read(const char *path, t_journal_visitor visitor, void *data)
+{
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1) {
+        return -1;
+    }
+
+    t_journal_header header;
+    struct stat st;
+
+    if (fstat(fd, &st) == -1 || pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        !header_valid(&header, st.st_size)) {
+        close(fd);
+        return -1;
+    }
+
+    uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    t_block_order *order = malloc(header.block_count * sizeof(t_block_order));
+
+    if (order == NULL) {
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    uint32_t used = 0;
+
+    for (uint32_t i = 0; i < header.block_count; i++) {
+        const uint64_t sequence = __atomic_load_n(&block_at(map, i)->sequence, __ATOMIC_ACQUIRE);
+
+        if (sequence != 0) {
+            order[used].sequence = sequence;
+            order[used].index = i;
+            used++;
+        }
+    }
+
+    qsort(order, used, sizeof(t_block_order), compare_blocks);
+
+    long total = 0;
+    uint8_t copy[JOURNAL_BLOCK_SIZE];
+
+    for (uint32_t i = 0; i < used; i++) {
+        // the daemon may be writing the journal: skip a block restarted meanwhile
+        const t_journal_block *block = block_at(map, order[i].index);
+        memcpy(copy, block, sizeof(copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&block->sequence, __ATOMIC_RELAXED) != order[i].sequence ||
+            ((t_journal_block *)copy)->sequence != order[i].sequence) {
+            continue;
+        }
+
+        const long count = read_block(copy, visitor, data);
+
+        if (count == -1) {
+            break;
+        }
+
+        total += count;
+    }
+
+    free(order);
+    munmap(map, st.st_size);
+    return total;
+}
+
+typedef struct {
+    FILE *out;
+    int sensor_count;
+    int fan_count;
+    long records;
+    uint64_t first_ms;
+    uint64_t last_ms;
+} t_dump;
+
+static bool dump_record(const t_journal_record *record, void *data)
+{
+    t_dump *dump = data;
+
+    if (dump->records == 0 || record->sensor_count != dump->sensor_count ||
+        record->fan_count != dump->fan_count) {
+        fprintf(dump->out, "# time,temp,fan_speed");
+
+        for (int i = 1; i <= record->sensor_count; i++) {
+            fprintf(dump->out, ",sensor%d", i);
+        }
+        for (int i = 1; i <= record->fan_count; i++) {
+            fprintf(dump->out, ",fan%d", i);
+        }
+        fprintf(dump->out, "\n");
+
+        dump->sensor_count = record->sensor_count;
+        dump->fan_count = record->fan_count;
+    }
+
+    fprintf(dump->out, "%llu.%03u,%.3f,%d", (unsigned long long)(record->time_ms / 1000),
+            (unsigned)(record->time_ms % 1000), record->temp / 1000.0, record->fan_speed);
+
+    for (int i = 0; i < record->sensor_count; i++) {
+        fprintf(dump->out, ",%.3f", record->sensor_temp[i] / 1000.0);
+    }
+    for (int i = 0; i < record->fan_count; i++) {
+        fprintf(dump->out, ",%d", record->fan_target[i]);
+    }
+    fprintf(dump->out, "\n");
+
+    if (dump->records++ == 0) {
+        dump->first_ms = record->time_ms;
+    }
+    dump->last_ms = record->time_ms;
+
+    return true;
+}
+
+static void format_time(uint64_t time_ms, char *buffer, size_t size)
+{
+    const time_t seconds = time_ms / 1000;
+    struct tm local;
+
+    localtime_r(&seconds, &local);
+    strftime(buffer, size, "%Y-%m-%d %H:%M:%S", &local);
+}
+
+bool journal_dump(const char *path, FILE *out)
+{
+    t_dump dump;
+    memset(&dump, 0, sizeof(dump));
+    dump.out = out;
+
+    if (journal_read(path, dump_record, &dump) == -1) {
+        return false;
+    }
+
+    if (dump.records > 0) {
+        char first[32];
+        char last[32];
+        format_time(dump.first_ms, first, sizeof(first));
+        format_time(dump.last_ms, last, sizeof(last));
+        fprintf(out, "# %ld records from %s to %s\n", dump.records, first, last);
+    } else {
+        fprintf(out, "# no records\n");
+    }
+
+    return true;
+}
@@ -0,0 +1,93 @@
+/**
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "mbpfan.h"
+
+#define JOURNAL_MAGIC 0x6d62706a  // "mbpj"
+#define JOURNAL_VERSION 1
+// Blocks are decoded on their own, each starts with a full record
+#define JOURNAL_BLOCK_SIZE 4096
+#define JOURNAL_MIN_SIZE (4 * JOURNAL_BLOCK_SIZE)
+
+/** File of the tick journal, empty to disable (the default)
+ *  Read at startup
+ */
+extern char journal_path[108];
+
+/** Size of the journal file in KiB, default 8192
+ *  A steady tick takes a byte or two, a month of 1 Hz ticks a few MiB
+ */
+extern int journal_size;
+
+/** One tick of the control loop
+ *  time_ms - CLOCK_REALTIME, milliseconds
+ *  temp - millidegrees, temperature driving the loop
+ *  fan_speed - base speed asked by the zones
+ *  sensor_temp - millidegrees of each sensor
+ *  fan_target - RPM commanded to each fan
+ */
+typedef struct {
+    uint64_t time_ms;
+    int32_t temp;
+    int32_t fan_speed;
+    int sensor_count;
+    int fan_count;
+    int32_t sensor_temp[MAX_SENSORS];
+    int32_t fan_target[MAX_FANS];
+} t_journal_record;
+
+/** Called for each record read, in time order. Return false to stop */
+typedef bool (*t_journal_visitor)(const t_journal_record *record, void *data);
+
+/**
+ * Open or create the journal file with the given size in bytes and map it.
+ * A journal of another size or format is started over.
+ * Return false if it could not be opened
+ */
+bool journal_open(const char *path, size_t size);
+
+/**
+ * Append a record. Does nothing unless journal_open() succeeded
+ */
+void journal_append(const t_journal_record *record);
+
+/**
+ * Append the current tick: the given values, sensor_samples and the fans list
+ */
+void journal_publish(float temp, int fan_speed);
+
+/**
+ * Unmap and close the journal
+ */
+void journal_close();
+
+/**
+ * Decode every record of a journal file, oldest first.
+ * Return the number of records read, -1 if the file is not a journal
+ */
+long journal_read(const char *path, t_journal_visitor visitor, void *data);
+
+/**
+ * Print a journal file as CSV lines: time, temp, base speed, then each
+ * sensor and each fan. Return false if the file is not a journal
+ */
+bool journal_dump(const char *path, FILE *out);
+
+#endif
@@ -20,17 +20,25 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <syslog.h>
 #include <stdbool.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <errno.h>
 #include "mbpfan.h"
+#include "hwmon.h"
+#include "simulator.h"
 #include "daemon.h"
 #include "global.h"
 #include "main.h"
 #include "minunit.h"
+#include "journal.h"
+#include "replay.h"
+#include "discovery.h"
+#include "zones.h"
 
 int daemonize = 1;
 int verbose = 0;
@@ -38,8 +46,8 @@ int verbose = 0;
 const char *PROGRAM_NAME = "mbpfan";
 const char *PROGRAM_PID = "/var/run/mbpfan.pid";
 
-const char *CORETEMP_PATH = "/sys/devices/platform/coretemp.0";
-const char *APPLESMC_PATH = "/sys/devices/platform/applesmc.768";
+const char *settings_path = NULL;
+
 
 void print_usage(int argc, char *argv[])
 {
@@ -47,9 +55,13 @@ void print_usage(int argc, char *argv[])
         printf("Usage: %s OPTION(S) \n", argv[0]);
         printf("Options:\n");
         printf("\t-h Show this help screen\n");
+        printf("\t-c <file> Use <file> instead of /etc/mbpfan.conf\n");
         printf("\t-f Run in foreground\n");
+        printf("\t-s <profile> Simulate the controller against a load profile (step, burst or a file)\n");
         printf("\t-t Run the tests\n");
         printf("\t-v Be (a lot) verbose\n");
+        printf("\t--dump-journal <file> Print the ticks recorded in a journal file as CSV\n");
+        printf("\t--replay <trace> [config...] Run the controller of each config over a journal or CSV trace\n");
         printf("\n");
     }
 }
@@ -59,76 +71,66 @@ void check_requirements()
 {
 
     /**
-     * Check for root
+     * Check for root, unless running against a fake sysfs tree
      */
 
     uid_t uid=getuid(), euid=geteuid();
 
-    if (uid != 0 || euid != 0) {
+    if ((uid != 0 || euid != 0) && strcmp(sysfs_root, "/sys") == 0) {
         syslog(LOG_ERR, "%s needs root privileges. Please run %s as root. Exiting.", PROGRAM_NAME, PROGRAM_NAME);
         printf("%s not started with root privileges. Please run %s as root. Exiting.\n", PROGRAM_NAME, PROGRAM_NAME);
         exit(EXIT_FAILURE);
     }
 
     /**
-      * Check for coretemp and applesmc modules
+      * Check for the sensor_drivers (or zone drivers) and applesmc modules,
+      * the settings must have been read
       */
-    DIR* dir = opendir(CORETEMP_PATH);
+    const t_discovery *discovery = discovery_get();
+    bool found_sensors = false;
 
-    if (ENOENT == errno) {
-        syslog(LOG_ERR, "%s needs coretemp support. Please either load it or build it into the kernel. Exiting.", PROGRAM_NAME);
-        printf("%s needs coretemp module.\nPlease either load it or build it into the kernel. Exiting.\n", PROGRAM_NAME);
-        exit(EXIT_FAILURE);
+    for (int i = 0; discovery != NULL && i < discovery->index.sensor_count; i++) {
+        if (hwmon_driver_listed(sensor_drivers, discovery->index.sensors[i].driver) ||
+            zones_want_driver(discovery->index.sensors[i].driver)) {
+            found_sensors = true;
+        }
     }
 
-    closedir(dir);
+    if (!found_sensors) {
+        syslog(LOG_ERR, "%s needs %s support. Please either load it or build it into the kernel. Exiting.", PROGRAM_NAME, sensor_drivers);
+        printf("%s needs %s module.\nPlease either load it or build it into the kernel. Exiting.\n", PROGRAM_NAME, sensor_drivers);
+        exit(EXIT_FAILURE);
+    }
 
 
-    dir = opendir(APPLESMC_PATH);
+    DIR* dir = opendir(applesmc_path);
 
-    if (ENOENT == errno) {
+    if (dir == NULL && ENOENT == errno) {
         syslog(LOG_ERR, "%s needs applesmc support. Please either load it or build it into the kernel. Exiting.", PROGRAM_NAME);
         printf("%s needs applesmc module.\nPlease either load it or build it into the kernel. Exiting.\n", PROGRAM_NAME);
         exit(EXIT_FAILURE);
     }
 
-    closedir(dir);
-
-
-}
+    if (dir != NULL) {
+        closedir(dir);
+    }
 
 
-static int read_value(const char *path)
-{
-    int value = -1;
-    FILE *file = fopen(path, "r");
-    if (file != NULL) {
-        fscanf(file, "%d", &value);
-        fclose(file);
-    }
-    return value;
 }
 
 
-static void set_defaults(void)
+// Use the limits of the fans for the speeds not set, unless probe is false
+static void set_defaults(bool probe)
 {
-    int i;
-    char *path;
-    int value;
-    for (i = 1; i <= 10; ++i) {
-        path = smprintf("%s/fan%d_min", APPLESMC_PATH, i);
-        value = read_value(path);
-        if (value != -1 && (min_fan_speed == -1 || value < min_fan_speed)) {
-            min_fan_speed = value;
-        }
-        free(path);
+    const t_discovery *discovery = probe ? discovery_get() : NULL;
 
-        path = smprintf("%s/fan%d_max", APPLESMC_PATH, i);
-        value = read_value(path);
-        if (value != -1 && (max_fan_speed == -1 || value > max_fan_speed)) {
-            max_fan_speed = value;
-        }
-        free(path);
+    if (discovery != NULL && discovery->fan_min_speed != -1 &&
+        (min_fan_speed == -1 || discovery->fan_min_speed < min_fan_speed)) {
+        min_fan_speed = discovery->fan_min_speed;
+    }
+    if (discovery != NULL && discovery->fan_max_speed != -1 &&
+        (max_fan_speed == -1 || discovery->fan_max_speed > max_fan_speed)) {
+        max_fan_speed = discovery->fan_max_speed;
     }
 
     if (min_fan_speed == -1) {
@@ -140,31 +142,65 @@ static void set_defaults(void)
 }
 
 
+enum {
+    OPTION_DUMP_JOURNAL = 256,
+    OPTION_REPLAY
+};
+
+static const struct option long_options[] = {
+    { "help", no_argument, NULL, 'h' },
+    { "dump-journal", required_argument, NULL, OPTION_DUMP_JOURNAL },
+    { "replay", required_argument, NULL, OPTION_REPLAY },
+    { NULL, 0, NULL, 0 }
+};
+
+
 int main(int argc, char *argv[])
 {
 
     int c;
+    const char *sim_profile = NULL;
+    const char *replay_trace = NULL;
 
-    while( (c = getopt(argc, argv, "hftv|help")) != -1) {
+    while( (c = getopt_long(argc, argv, "hc:fs:tv", long_options, NULL)) != -1) {
         switch(c) {
         case 'h':
             print_usage(argc, argv);
             exit(EXIT_SUCCESS);
             break;
 
+        case 'c':
+            settings_path = optarg;
+            break;
+
         case 'f':
             daemonize = 0;
             break;
 
+        case 's':
+            sim_profile = optarg;
+            break;
+
         case 't':
-            tests();
-            exit(EXIT_SUCCESS);
+            exit(tests() == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
             break;
 
         case 'v':
             verbose = 1;
             break;
 
+        case OPTION_DUMP_JOURNAL:
+            if (!journal_dump(optarg, stdout)) {
+                fprintf(stderr, "%s is not a journal file\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            exit(EXIT_SUCCESS);
+            break;
+
+        case OPTION_REPLAY:
+            replay_trace = optarg;
+            break;
+
         default:
             print_usage(argc, argv);
             exit(EXIT_SUCCESS);
@@ -174,8 +210,24 @@ int main(int argc, char *argv[])
 
 
 
+    retrieve_sysfs_root(settings_path);
+
+    if (sim_profile != NULL) {
+        daemonize = 0;
+        set_defaults(true);
+        exit(simulation(sim_profile) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if (replay_trace != NULL) {
+        daemonize = 0;
+        set_defaults(false);
+        exit(replay(replay_trace, argv + optind, argc - optind) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    set_defaults(true);
+    // the requirements depend on the configured drivers
+    retrieve_settings(settings_path);
     check_requirements();
-    set_defaults();
 
     // pointer to mbpfan() function in mbpfan.c
     void (*fan_control)() = mbpfan;
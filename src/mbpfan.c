@@ -37,10 +37,28 @@
 #include <syslog.h>
 #include <stdbool.h>
 #include <sys/utsname.h>
+#include <sys/prctl.h>
+#include <sys/timerfd.h>
+#include <fcntl.h>
 #include <sys/errno.h>
 #include "mbpfan.h"
 #include "global.h"
 #include "settings.h"
+#include "sampler.h"
+#include "hwmon.h"
+#include "histogram.h"
+#include "zones.h"
+#include "aggregate.h"
+#include "filter.h"
+#include "events.h"
+#include "config.h"
+#include "control.h"
+#include "telemetry.h"
+#include "metrics.h"
+#include "journal.h"
+#include "state.h"
+#include "discovery.h"
+#include "realtime.h"
 
 /* lazy min/max... */
 #define min(a,b) ((a) < (b) ? (a) : (b))
@@ -59,8 +77,44 @@ int max_temp = 86;   // do not set it > 90
 
 int polling_interval = 7;
 
+/* adaptive polling
+ * adaptive_polling_max - longest interval in seconds while idle, 0 disables
+ * adaptive_polling_fast_ms - interval used while the temperature is rising quickly
+ * adaptive_polling_slope - rate of rise in C/s that switches to the fast interval
+ * adaptive_polling_margin - degrees around low_temp/max_temp that count as cool/hot */
+int adaptive_polling_max = 0;
+int adaptive_polling_fast_ms = 500;
+float adaptive_polling_slope = 1.0;
+int adaptive_polling_margin = 5;
+
+/* Fan write suppression
+ * fan_deadband - speed changes up to this many RPM are not written
+ * fan_dwell - seconds a fan keeps its speed before it is changed again */
+int fan_deadband = 0;
+int fan_dwell = 0;
+
+// Prefix of every hwmon and applesmc path, see set_sysfs_root()
+char sysfs_root[256] = "/sys";
+char applesmc_path[sizeof(sysfs_root) + 32] = "/sys/devices/platform/applesmc.768";
+
+// Comma-delimited list of hwmon drivers whose sensors are averaged
+char sensor_drivers[64] = "coretemp,k10temp";
+
+// Sleep on hwmon alarms instead of polling while cool
+bool use_alarms = false;
+
+// Latency of each phase of the control loop, in ns
+t_histogram loop_histograms[LOOP_PHASES];
+const char* loop_phase_names[LOOP_PHASES] = { "read", "compute", "write", "oversleep" };
+
+t_history temp_history;
+int temp_window = 5;
+
+// Read all the sensors with a single io_uring submission
+bool use_io_uring = false;
+
 // Per-fan settings
-char* fan_list = NULL;
+char fan_list[10 * MAX_FANS] = "";
 float fan_ratios[MAX_FANS];
 int fan_min_speeds[MAX_FANS];
 int fan_max_speeds[MAX_FANS];
@@ -92,95 +146,94 @@ char *smprintf(const char *fmt, ...)
     return buf;
 }
 
-bool is_modern_sensors_path()
+uint32_t crc32(const void *data, size_t length)
 {
-    struct utsname kernel;
-    uname(&kernel);
-
-    char *str_kernel_version;
-    str_kernel_version = strtok(kernel.release, ".");
+    const uint8_t *bytes = data;
+    uint32_t crc = 0xffffffff;
 
-    if (atoi(str_kernel_version) < 3){
-        FAIL("mbpfan detected a pre-3.x.x linux kernel. Detected version: %s. Exiting.", kernel.release);
-    }
-
-    int counter;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= bytes[i];
 
-    for (counter = 0; counter < 10; counter++) {
-        int temp;
-        for (temp = 1; temp < 10; ++temp) {
-            char *path = smprintf("/sys/devices/platform/coretemp.0/hwmon/hwmon%d/temp%d_input", counter, temp);
-            int res = access(path, R_OK);
-            free(path);
-            if (res == 0) {
-                return 1;
-            }
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
         }
     }
 
-    return 0;
+    return ~crc;
 }
 
-
-t_sensors *retrieve_sensors()
+/* Look for a tempN_max_alarm next to the tempN_input of the sensor,
+ * together with a writable tempN_max to program. tempN_crit is left to
+ * the platform, and the original tempN_max is kept to be restored */
+static void retrieve_sensor_alarm(t_sensors *s)
 {
+    const int prefix_len = strlen(s->path) - strlen("_input");
 
-    t_sensors *sensors_head = NULL;
-    t_sensors *s = NULL;
+    s->alarm_fd = -1;
+    s->threshold_file = NULL;
+    s->alarm_threshold = 0;
+    s->threshold_original = 0;
 
-    char *path = NULL;
-    char *path_begin = NULL;
+    char *alarm_path = smprintf("%.*s_max_alarm", prefix_len, s->path);
+    char *threshold_path = smprintf("%.*s_max", prefix_len, s->path);
 
-    if (!is_modern_sensors_path()) {
-        if(verbose) {
-            LOG("Using legacy sensor path for kernel < 3.15.0");
-        }
-
-        path_begin = strdup("/sys/devices/platform/coretemp.0/temp");
+    int fd = open(alarm_path, O_RDONLY | O_CLOEXEC);
+    FILE *file = fd != -1 ? fopen(threshold_path, "r+") : NULL;
 
-    } else {
+    if (file != NULL && fscanf(file, "%d", &s->threshold_original) == 1) {
+        s->alarm_fd = fd;
+        s->threshold_file = file;
 
-        if(verbose) {
-            LOG("Using new sensor path for kernel >= 3.15.0 or some CentOS versions with kernel 3.10.0");
+        if (verbose) {
+            LOG("Found alarm %s", alarm_path);
         }
 
-        path_begin = strdup("/sys/devices/platform/coretemp.0/hwmon/hwmon");
-
-        int counter;
-        for (counter = 0; counter < 10; counter++) {
-
-            char hwmon_path[strlen(path_begin)+2];
+    } else {
+        if (file != NULL) {
+            fclose(file);
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+    }
 
-            sprintf(hwmon_path, "%s%d", path_begin, counter);
+    free(alarm_path);
+    free(threshold_path);
+}
 
-            int res = access(hwmon_path, R_OK);
-            if (res == 0) {
+t_sensors *retrieve_sensors()
+{
 
-                free(path_begin);
-                path_begin = smprintf("%s/temp", hwmon_path);
+    t_sensors *sensors_head = NULL;
+    t_sensors *s = NULL;
 
-                if(verbose) {
-                    LOG("Found hwmon path at %s", path_begin);
-                }
+    const t_discovery *discovery = discovery_get();
 
-                break;
-            }
-        }
+    if (discovery == NULL) {
+        FAIL("mbpfan could not read %s/class/hwmon. Exiting.", sysfs_root);
     }
 
-    const char *path_end = "_input";
-
     int sensors_found = 0;
 
-    int counter = 0;
-    for(counter = 0; counter<10; counter++) {
-        path = smprintf("%s%d%s", path_begin, counter, path_end);
+    for (int i = 0; i < discovery->index.sensor_count; i++) {
+        const t_hwmon_sensor *found = &discovery->index.sensors[i];
 
-        FILE *file = fopen(path, "r");
+        if (zones_want_driver(found->driver)) {
+            // zones pick their own sensors
+
+        } else if (!hwmon_driver_listed(sensor_drivers, found->driver) ||
+                   (*sensor_labels && !label_listed(sensor_labels, found->label))) {
+            continue;
+        }
+
+        FILE *file = fopen(found->input_path, "r");
 
         if(file != NULL) {
             s = (t_sensors *) malloc( sizeof( t_sensors ) );
-            s->path = strdup(path);
+            s->path = strdup(found->input_path);
+            s->label = strdup(found->label);
+            s->driver = strdup(found->driver);
+            s->weight = sensor_weight(s->label);
             fscanf(file, "%d", &s->temperature);
 
             if (sensors_head == NULL) {
@@ -199,11 +252,18 @@ t_sensors *retrieve_sensors()
             }
 
             s->file = file;
+            s->alarm_fd = -1;
+            s->threshold_file = NULL;
+
+            if (use_alarms) {
+                retrieve_sensor_alarm(s);
+            }
             sensors_found++;
-        }
 
-        free(path);
-        path = NULL;
+            if(verbose) {
+                LOG("Found %s sensor '%s' at %s, weight %.1f", found->driver, s->label, s->path, s->weight);
+            }
+        }
     }
 
     if(verbose) {
@@ -214,39 +274,34 @@ t_sensors *retrieve_sensors()
         FAIL("mbpfan could not detect any temp sensor. Please contact the developer.");
     }
 
-    free(path_begin);
-    path_begin = NULL;
+    if (use_io_uring && !sampler_init(sensors_head)) {
+        LOG("io_uring is not available, falling back to pread for sensors");
+    }
 
     return sensors_head;
 }
 
-void populate_fan_list()
+// Copy the MAX_SEARCH_FANS fan#_label found at startup, missing fans get an empty label
+static void read_fan_labels(char labels[MAX_SEARCH_FANS][100])
 {
-    free(fan_list);
-    fan_list = malloc(10 * MAX_FANS);
-    *fan_list = '\0';
+    const t_discovery *discovery = discovery_get();
 
-    for (int counter = 0; counter < MAX_SEARCH_FANS; counter++) {
-        char* path_label = smprintf("/sys/devices/platform/applesmc.768/fan%d_label", counter);
-
-        FILE* file = fopen(path_label, "r");
-        if (file != NULL) {
-            char label[1024];
-            memset(label, 0, sizeof(label));
-            fread(label, sizeof(label), 1, file);
-
-            // Remove trailing spaces
-            char* last = label + strlen(label) - 1;
-            while (isspace(*last) && last != label) last--;
-            *(last + 1) = '\0';
+    if (discovery != NULL) {
+        memcpy(labels, discovery->fan_labels, MAX_SEARCH_FANS * sizeof(labels[0]));
+    } else {
+        memset(labels, 0, MAX_SEARCH_FANS * sizeof(labels[0]));
+    }
+}
 
-            strncat(fan_list, label, sizeof(label));
-            strncat(fan_list, ",", sizeof(","));
+static void populate_fan_list(char labels[MAX_SEARCH_FANS][100])
+{
+    *fan_list = '\0';
 
-            fclose(file);
+    for (int counter = 0; counter < MAX_SEARCH_FANS; counter++) {
+        if (*labels[counter]) {
+            strncat(fan_list, labels[counter], 10 * MAX_FANS - strlen(fan_list) - 2);
+            strcat(fan_list, ",");
         }
-
-        free(path_label);
     }
     // Remove trailing ,
     if (*fan_list) {
@@ -256,8 +311,11 @@ void populate_fan_list()
 
 t_fans* retrieve_fans()
 {
-    if (!fan_list) {
-        populate_fan_list();
+    char labels[MAX_SEARCH_FANS][100];
+    read_fan_labels(labels);
+
+    if (!*fan_list) {
+        populate_fan_list(labels);
     }
 
     LOG("fan_list: %s", fan_list);
@@ -281,24 +339,6 @@ t_fans* retrieve_fans()
         FAIL("mbpfan could not detect any fan. Please contact the developer.");
     }
 
-    // Read up to MAX_SEARCH_FANS labels from fan#_label
-    char labels[MAX_SEARCH_FANS][100];
-    memset(labels, 0, sizeof(labels));
-
-    for (int counter = 0; counter < MAX_SEARCH_FANS; counter++) {
-        char* path_label = smprintf("/sys/devices/platform/applesmc.768/fan%d_label", counter);
-
-        FILE *file = fopen(path_label, "r");
-        if (file != NULL) {
-            fread(labels[counter], sizeof(labels[counter]), 1, file);
-            labels[counter][strlen(labels[counter]) - 2] = '\0';
-
-            fclose(file);
-        }
-
-        free(path_label);
-    }
-
     // Create fan list
     t_fans* fans_head = NULL;
     t_fans* fan = NULL;
@@ -329,13 +369,16 @@ t_fans* retrieve_fans()
             FAIL("Unable to find ID of fan '%s'", fan_names[fan_counter]);
         }
 
-        fan->fan_output_path = smprintf("/sys/devices/platform/applesmc.768/fan%d_output", fan->fan_id);
-        fan->fan_manual_path = smprintf("/sys/devices/platform/applesmc.768/fan%d_manual", fan->fan_id);
+        fan->fan_output_path = smprintf("%s/fan%d_output", applesmc_path, fan->fan_id);
+        fan->fan_manual_path = smprintf("%s/fan%d_manual", applesmc_path, fan->fan_id);
 
         fan->file = fopen(fan->fan_output_path, "w");
         if(fan->file == NULL) {
             FAIL("Unable to open '%s'", fan->fan_output_path);
         }
+
+        // a missing fan#_manual is reported by set_fans_man()
+        fan->manual_fd = open(fan->fan_manual_path, O_WRONLY);
     }
 
     if(verbose) {
@@ -348,220 +391,293 @@ t_fans* retrieve_fans()
     return fans_head;
 }
 
-static void set_fans_mode(t_fans *fans, int mode)
+static int set_fans_mode(t_fans *fans, int mode)
 {
-    t_fans *tmp = fans;
-    FILE *file;
-
-    while(tmp != NULL) {
-        file = fopen(tmp->fan_manual_path, "rw+");
+    const char *buf = mode ? "1" : "0";
+    int failed = 0;
 
-        if(file != NULL) {
-            fprintf(file, "%d", mode);
-            fclose(file);
+    for (t_fans *tmp = fans; tmp != NULL; tmp = tmp->next) {
+        if (tmp->manual_fd == -1 || pwrite(tmp->manual_fd, buf, 1, /*offset=*/ 0) != 1) {
+            LOG("Could not set fan %s to %s mode", tmp->name, mode ? "manual" : "automatic");
+            failed++;
         }
-
-        tmp = tmp->next;
     }
+
+    return failed;
 }
 
-void set_fans_man(t_fans *fans)
+int set_fans_man(t_fans *fans)
 {
-    set_fans_mode(fans, 1);
+    return set_fans_mode(fans, 1);
 }
 
-void set_fans_auto(t_fans *fans)
+int set_fans_auto(t_fans *fans)
 {
-    set_fans_mode(fans, 0);
+    return set_fans_mode(fans, 0);
 }
 
-t_sensors *refresh_sensors(t_sensors *sensors)
+static void read_sensors(t_sensors *sensors)
 {
-    t_sensors *tmp = sensors;
+    if (!sampler_active() || !sampler_refresh()) {
+        t_sensors *tmp = sensors;
+
+        while(tmp != NULL) {
+            if(tmp->file != NULL) {
+                char buf[16];
+                int len = pread(fileno(tmp->file), buf, sizeof(buf) - 1, /*offset=*/ 0);
+                if (len > 0) {
+                    buf[len] = '\0';
+                    sscanf(buf, "%d", &tmp->temperature);
+                } else {
+                    sampler_stats.read_errors++;
+                }
+                sampler_stats.sensors++;
+                sampler_stats.syscalls++;
+            }
 
-    while(tmp != NULL) {
-        if(tmp->file != NULL) {
-            char buf[16];
-            int len = pread(fileno(tmp->file), buf, sizeof(buf), /*offset=*/ 0);
-            buf[len] = '\0';
-            sscanf(buf, "%d", &tmp->temperature);
+            tmp = tmp->next;
         }
-
-        tmp = tmp->next;
     }
-
-    return sensors;
 }
 
-
-/* Controls the speed of the fan */
-void set_fan_speed(t_fans* fans, int speed)
+t_sensors *refresh_sensors(t_sensors *sensors)
 {
-    t_fans* fan = fans;
-    while(fan != NULL) {
-        const int fan_speed = max(min(speed * fan->speed_ratio, fan->max_speed), fan->min_speed);
-        /*
-        if (verbose) {
-            LOG("%9s: %d * %.01f = %.0f -> %4d RPM (min %4d max %4d)",
-                fan->name, speed, fan->speed_ratio, speed * fan->speed_ratio,
-                fan_speed, fan->min_speed, fan->max_speed);
-        }
-        */
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-        if(fan->file != NULL && fan->old_speed != speed) {
-            char buf[16];
-            int len = snprintf(buf, sizeof(buf), "%d", fan_speed);
-            int res = pwrite(fileno(fan->file), buf, len, /*offset=*/ 0);
-            if (res == -1) {
-                perror("Could not set fan speed");
+    sampler_stats.sensors = 0;
+    sampler_stats.syscalls = 0;
+    sampler_stats.passes = 1;
+
+    read_sensors(sensors);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    sampler_stats.nsec = (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+
+    if (filter_oversample > 1) {
+        static int reads[MAX_SENSORS][FILTER_MAX_OVERSAMPLE];
+        const struct timespec gap = { 0, FILTER_OVERSAMPLE_GAP_MS * 1000000L };
+        // the stats describe a single pass over the sensors
+        const t_sampler_stats pass = sampler_stats;
+
+        for (int n = 0; n < filter_oversample; n++) {
+            if (n > 0) {
+                if (sensors != NULL && sensors->file != NULL) {
+                    nanosleep(&gap, NULL);
+                }
+                read_sensors(sensors);
+            }
+
+            int i = 0;
+            for (t_sensors *tmp = sensors; tmp != NULL && i < MAX_SENSORS; tmp = tmp->next, i++) {
+                reads[i][n] = tmp->temperature;
             }
-            fan->old_speed = fan_speed;
         }
 
-        fan = fan->next;
-    }
-}
+        int i = 0;
+        for (t_sensors *tmp = sensors; tmp != NULL && i < MAX_SENSORS; tmp = tmp->next, i++) {
+            tmp->temperature = median_of(reads[i], filter_oversample);
+        }
 
+        const unsigned long read_errors = sampler_stats.read_errors;
+        sampler_stats = pass;
+        sampler_stats.read_errors = read_errors;
+        sampler_stats.passes = filter_oversample;
+    }
 
-float get_temp(t_sensors* sensors)
-{
-    sensors = refresh_sensors(sensors);
-    int sum_temp = 0;
+    samples_update(sensors, start.tv_sec + start.tv_nsec / 1e9);
 
-    t_sensors* sensor = sensors;
-    int number_sensors = 0;
+    return sensors;
+}
 
-    while (sensor != NULL) {
-        sum_temp += sensor->temperature;
-        sensor = sensor->next;
-        number_sensors++;
-    }
 
-    // just to be safe
-    if (number_sensors == 0) {
-        number_sensors++;
+bool sensors_have_alarms(t_sensors *sensors)
+{
+    for (t_sensors *tmp = sensors; tmp != NULL; tmp = tmp->next) {
+        if (tmp->alarm_fd == -1) {
+            return false;
+        }
     }
 
-    return (float)sum_temp / (number_sensors * 1000);
+    return sensors != NULL;
 }
 
-
-void retrieve_settings(const char* settings_path)
+int arm_sensor_alarms(t_sensors *sensors, int threshold)
 {
-    Settings *settings = NULL;
-    int result = 0;
-    FILE *f = NULL;
+    for (t_sensors *tmp = sensors; tmp != NULL; tmp = tmp->next) {
+        char buf[16];
+
+        if (tmp->alarm_threshold != threshold) {
+            rewind(tmp->threshold_file);
+            fprintf(tmp->threshold_file, "%d\n", threshold * 1000);
+            if (fflush(tmp->threshold_file) != 0) {
+                return -1;
+            }
+            tmp->alarm_threshold = threshold;
+        }
 
-    if (settings_path == NULL) {
-        f = fopen("/etc/mbpfan.conf", "r");
+        // sysfs only notifies pollers after the attribute has been read
+        int len = pread(tmp->alarm_fd, buf, sizeof(buf) - 1, /*offset=*/ 0);
+        if (len <= 0) {
+            return -1;
+        }
+        buf[len] = '\0';
 
-    } else {
-        f = fopen(settings_path, "r");
+        if (atoi(buf) != 0) {
+            // already above the threshold
+            return 1;
+        }
     }
 
-    if (f == NULL) {
-        /* Could not open configfile */
-        if(verbose) {
-            LOG("Couldn't open configfile, using defaults");
+    return 0;
+}
+
+void restore_sensor_alarms(t_sensors *sensors)
+{
+    for (t_sensors *tmp = sensors; tmp != NULL; tmp = tmp->next) {
+        if (tmp->threshold_file == NULL || tmp->alarm_threshold == 0) {
+            continue;
         }
 
-    } else {
-        settings = settings_open(f);
-        fclose(f);
+        rewind(tmp->threshold_file);
+        fprintf(tmp->threshold_file, "%d\n", tmp->threshold_original);
+        fflush(tmp->threshold_file);
+        tmp->alarm_threshold = 0;
+    }
+}
 
-        if (settings == NULL) {
-            /* Could not read configfile */
-            if(verbose) {
-                LOG("Couldn't read configfile");
-            }
+/* Controls the speed of the fan */
+static uint64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-        } else {
-            /* Read configfile values */
-            result = settings_get_int(settings, "general", "min_fan_speed");
+void set_fan_speed(t_fans* fans, int speed)
+{
+    set_fan_speed_at(fans, speed, false, monotonic_ns() / 1000000);
+}
 
-            if (result != 0) {
-                min_fan_speed = result;
-            }
+void set_fan_speeds(t_fans* fans, const int* speeds)
+{
+    set_fan_speeds_at(fans, speeds, false, monotonic_ns() / 1000000);
+}
 
-            result = settings_get_int(settings, "general", "max_fan_speed");
+void set_fan_speed_at(t_fans* fans, int speed, bool hot, long now_ms)
+{
+    int speeds[MAX_FANS];
 
-            if (result != 0) {
-                max_fan_speed = result;
-            }
+    for (int i = 0; i < MAX_FANS; i++) {
+        speeds[i] = speed;
+    }
 
-            result = settings_get_int(settings, "general", "low_temp");
+    set_fan_speeds_at(fans, speeds, hot, now_ms);
+}
 
-            if (result != 0) {
-                low_temp = result;
-            }
+void set_fan_speeds_at(t_fans* fans, const int* speeds, bool hot, long now_ms)
+{
+    t_fans* fan = fans;
+    for (int index = 0; fan != NULL && index < MAX_FANS; index++) {
+        const int speed = speeds[index];
+        const int fan_speed = max(min(speed * fan->speed_ratio, fan->max_speed), fan->min_speed);
+        /*
+        if (verbose) {
+            LOG("%9s: %d * %.01f = %.0f -> %4d RPM (min %4d max %4d)",
+                fan->name, speed, fan->speed_ratio, speed * fan->speed_ratio,
+                fan_speed, fan->min_speed, fan->max_speed);
+        }
+        */
 
-            result = settings_get_int(settings, "general", "high_temp");
+        // never hold back a fan climbing above high_temp or reaching a limit,
+        // a deadband would otherwise keep it just off min_speed for good
+        const bool urgent = fan->old_speed == 0 || fan_speed == fan->max_speed || fan_speed == fan->min_speed ||
+                            (hot && fan_speed > fan->old_speed);
 
-            if (result != 0) {
-                high_temp = result;
-            }
+        if (fan->old_speed == fan_speed) {
+            // nothing to do
 
-            result = settings_get_int(settings, "general", "max_temp");
+        } else if (!urgent && (abs(fan_speed - fan->old_speed) <= fan_deadband ||
+                               now_ms - fan->last_write_ms < fan_dwell * 1000L)) {
+            fan->suppressed++;
 
-            if (result != 0) {
-                max_temp = result;
+        } else {
+            if(fan->file != NULL) {
+                char buf[16];
+                int len = snprintf(buf, sizeof(buf), "%d\n", fan_speed);
+                int res = pwrite(fileno(fan->file), buf, len, /*offset=*/ 0);
+                if (res == -1) {
+                    perror("Could not set fan speed");
+                }
             }
+            fan->old_speed = fan_speed;
+            fan->last_write_ms = now_ms;
+            fan->writes++;
+        }
 
-            result = settings_get_int(settings, "general", "polling_interval");
-
-            if (result != 0) {
-                polling_interval = result;
-            }
+        fan = fan->next;
+    }
+}
 
-            char fan_list_temp[10 * MAX_FANS];
-            result = settings_get(settings, "general", "fan_list", fan_list_temp, sizeof(fan_list_temp));
 
-            if (result != 0) {
-                fan_list = strdup(fan_list_temp);
-            }
+float get_temp(t_sensors* sensors)
+{
+    sensors = refresh_sensors(sensors);
+    return aggregate_temp(&sensor_samples, ~0ULL, &temp_aggregation);
+}
 
-            double fan_ratios_temp[MAX_FANS];
-            result = settings_get_double_tuple(settings, "general", "fan_ratios", fan_ratios_temp, MAX_FANS, NULL);
 
-            for (int i = 0; i < MAX_FANS; i++) {
-                fan_ratios[i] = (result != 0) ? max(0.1, fan_ratios_temp[i]) : 1.0;
-            }
+void set_sysfs_root(const char* root)
+{
+    snprintf(sysfs_root, sizeof(sysfs_root), "%s", root);
+    snprintf(applesmc_path, sizeof(applesmc_path), "%s/devices/platform/applesmc.768", sysfs_root);
+}
 
-            result = settings_get_int_tuple(settings, "general", "fan_min_speeds", fan_min_speeds, MAX_FANS, NULL);
+void retrieve_sysfs_root(const char* settings_path)
+{
+    bool cache_set = false;
+    FILE *f = fopen(settings_path == NULL ? "/etc/mbpfan.conf" : settings_path, "r");
 
-            if (result == 0) {
-                for (int i = 0; i < MAX_FANS; i++) fan_min_speeds[i] = min_fan_speed;
-            }
+    if (f != NULL) {
+        Settings *settings = settings_open(f);
+        fclose(f);
 
-            result = settings_get_int_tuple(settings, "general", "fan_max_speeds", fan_max_speeds, MAX_FANS, NULL);
+        if (settings != NULL) {
+            char root[sizeof(sysfs_root)];
+            char cache[sizeof(discovery_cache)];
 
-            if (result == 0) {
-                for (int i = 0; i < MAX_FANS; i++) fan_max_speeds[i] = max_fan_speed;
+            if (settings_get(settings, "general", "sysfs_root", root, sizeof(root))) {
+                set_sysfs_root(root);
             }
 
-            int pid_values_temp[10];
-            unsigned int readCount = 0;
-            result = settings_get_int_tuple(settings, "general", "pid_values", pid_values_temp, 10, &readCount);
-
-            if (result != 0) {
-                if (readCount != 3) FAIL("Wrong number of PID constants, 3 expected.");
-                pid_values = malloc(sizeof(float) * 3);
-                pid_values[0] = pid_values_temp[0];
-                pid_values[1] = pid_values_temp[1];
-                pid_values[2] = pid_values_temp[2];
+            if (settings_get(settings, "general", "discovery_cache", cache, sizeof(cache))) {
+                snprintf(discovery_cache, sizeof(discovery_cache), "%s",
+                         strcmp(cache, "no") == 0 ? "" : cache);
+                cache_set = true;
             }
 
-            /* Destroy the settings object */
             settings_delete(settings);
         }
     }
 
-    // Sanity checks
-    if (min_fan_speed > max_fan_speed) {
-        FAIL("Invalid fan speeds: min_fan_speed %d, max_fan_speed %d", min_fan_speed, max_fan_speed);
+    const char *env = getenv("MBPFAN_SYSFS_ROOT");
+
+    if (env != NULL && *env != '\0') {
+        set_sysfs_root(env);
     }
-    if (low_temp > high_temp || high_temp > max_temp) {
-        FAIL("Invalid temperatures: low_temp %d, high_temp %d, max_temp %d", low_temp, high_temp, max_temp);
+
+    // the default cache describes this machine, not another tree
+    if (!cache_set && strcmp(sysfs_root, "/sys") != 0) {
+        *discovery_cache = '\0';
+    }
+}
+
+void retrieve_settings(const char* settings_path)
+{
+    char error[256];
+
+    if (!config_load(settings_path, error, sizeof(error))) {
+        FAIL("%s", error);
     }
 }
 
@@ -569,90 +685,112 @@ void retrieve_settings(const char* settings_path)
 // "Classic" fan control
 //
 
-typedef struct
+void settings_thresholds(t_thresholds* thresholds)
 {
-    int step_up;
-    int step_down;
-    int fan_speed;
-    int old_temp;
-} t_state_classic;
+    memset(thresholds, 0, sizeof(*thresholds));
+
+    thresholds->low_temp = low_temp;
+    thresholds->high_temp = high_temp;
+    thresholds->max_temp = max_temp;
+    thresholds->min_fan_speed = min_fan_speed;
+    thresholds->max_fan_speed = max_fan_speed;
 
-void fan_speed_classic_init(t_state_classic* state, float start_temperature)
+    if (pid_values) {
+        memcpy(thresholds->pid_values, pid_values, sizeof(thresholds->pid_values));
+    }
+}
+
+void fan_speed_classic_init(t_state_classic* state, float start_temperature, const t_thresholds* thresholds)
 {
     memset(state, 0, sizeof(*state));
 
-    state->step_up = (float)( max_fan_speed - min_fan_speed ) /
-                     (float)( ( max_temp - high_temp ) * ( max_temp - high_temp + 1 ) / 2 );
+    if (thresholds) {
+        state->limits = *thresholds;
+    } else {
+        settings_thresholds(&state->limits);
+    }
 
-    state->step_down = (float)( max_fan_speed - min_fan_speed ) /
-                       (float)( ( max_temp - low_temp ) * ( max_temp - low_temp + 1 ) / 2 );
+    const t_thresholds* t = &state->limits;
 
-    state->fan_speed = min_fan_speed;
-    state->old_temp = start_temperature;
+    state->step_up = (float)( t->max_fan_speed - t->min_fan_speed ) /
+                     (float)( ( t->max_temp - t->high_temp ) * ( t->max_temp - t->high_temp + 1 ) / 2 );
+
+    state->step_down = (float)( t->max_fan_speed - t->min_fan_speed ) /
+                       (float)( ( t->max_temp - t->low_temp ) * ( t->max_temp - t->low_temp + 1 ) / 2 );
 
-    LOG("Classic control initialized.");
+    state->fan_speed = t->min_fan_speed;
+    state->old_temp = start_temperature;
 }
 
 int fan_speed_classic(float temperature, t_state_classic* state)
 {
+    const t_thresholds* t = &state->limits;
     const int new_temp = temperature; // Keep int logic for classic
-    const int temp_change = new_temp - state->old_temp;
+    // only the direction of the trend matters, a slow rise is still a rise
+    float temp_change = state->history
+        ? history_slope(state->history)
+        : new_temp - state->old_temp;
     state->old_temp = new_temp;
 
-    if(new_temp >= max_temp && state->fan_speed != max_fan_speed) {
-        return max_fan_speed;
+    if (fabsf(temp_change) < CLASSIC_SLOPE_DEADBAND) {
+        temp_change = 0;
     }
 
-    if(new_temp <= low_temp && state->fan_speed != min_fan_speed) {
-        return min_fan_speed;
+    if(new_temp >= t->max_temp && state->fan_speed != t->max_fan_speed) {
+        return t->max_fan_speed;
     }
 
-    if(temp_change > 0 && new_temp > high_temp && new_temp < max_temp) {
-        const int steps = ( new_temp - high_temp ) * ( new_temp - high_temp + 1 ) / 2;
-        return max( state->fan_speed, ceil(min_fan_speed + steps * state->step_up) );
+    if(new_temp <= t->low_temp && state->fan_speed != t->min_fan_speed) {
+        return t->min_fan_speed;
     }
 
-    if(temp_change < 0 && new_temp > low_temp && new_temp < max_temp) {
-        const int steps = ( max_temp - new_temp ) * ( max_temp - new_temp + 1 ) / 2;
-        return min( state->fan_speed, floor(max_fan_speed - steps * state->step_down) );
+    if(temp_change > 0 && new_temp > t->high_temp && new_temp < t->max_temp) {
+        const int steps = ( new_temp - t->high_temp ) * ( new_temp - t->high_temp + 1 ) / 2;
+        return max( state->fan_speed, ceil(t->min_fan_speed + steps * state->step_up) );
     }
 
-    return min_fan_speed;
-}
-
-//
-// PID fan control
-//
+    if(temp_change < 0 && new_temp > t->low_temp && new_temp < t->max_temp) {
+        const int steps = ( t->max_temp - new_temp ) * ( t->max_temp - new_temp + 1 ) / 2;
+        return min( state->fan_speed, floor(t->max_fan_speed - steps * state->step_down) );
+    }
 
-typedef struct
-{
-    float error_prior;
-    float integral;
-    int last_speed;
-} t_state_pid;
+    return t->min_fan_speed;
+}
 
-void fan_speed_pid_init(t_state_pid* state)
+void fan_speed_pid_init(t_state_pid* state, const t_thresholds* thresholds)
 {
     memset(state, 0, sizeof(*state));
 
+    if (thresholds) {
+        state->limits = *thresholds;
+    } else {
+        settings_thresholds(&state->limits);
+    }
+
     state->error_prior = 0;
     state->integral = 0;
     state->last_speed = 0;
-    LOG("PID control initialized. Kp=%.1f Ki=%.1f Kd=%.1f", pid_values[0], pid_values[1], pid_values[2]);
+    state->interval = polling_interval;
 }
 
 int fan_speed_pid(float temperature, t_state_pid* state)
 {
-    if (temperature > low_temp)
-    {
-        const float error = temperature - high_temp; // high_temp is the target temperature
-        state->integral = state->integral + (error * polling_interval);
-
-        const int p = pid_values[0] * error;
-        const int i = pid_values[1] * state->integral;
-        const int d = pid_values[2] * (error - state->error_prior) / polling_interval;
+    const t_thresholds* t = &state->limits;
 
-        const int new_speed = max(min_fan_speed + p + i + d, min_fan_speed); // min_fan_speed is the bias
+    if (temperature > t->low_temp)
+    {
+        const float error = temperature - t->high_temp; // high_temp is the target temperature
+        state->integral = state->integral + (error * state->interval);
+
+        const int p = t->pid_values[0] * error;
+        const int i = t->pid_values[1] * state->integral;
+        const int d = state->kalman
+            ? t->pid_values[2] * state->kalman->rate
+            : state->history
+            ? t->pid_values[2] * history_slope(state->history)
+            : t->pid_values[2] * (error - state->error_prior) / state->interval;
+
+        const int new_speed = max(t->min_fan_speed + p + i + d, t->min_fan_speed); // min_fan_speed is the bias
         if (verbose) {
             const int delta = new_speed - state->last_speed;
             LOG("PID: Error %.1fC. P=%d I=%d D=%d -> %d RPM (%+d RPM)",
@@ -665,7 +803,7 @@ int fan_speed_pid(float temperature, t_state_pid* state)
     else
     {
         // Discard PID state once we go below low_temp and set min_fan_speed
-        state->last_speed = min_fan_speed;
+        state->last_speed = t->min_fan_speed;
         state->integral = 0;
         state->error_prior = 0;
     }
@@ -673,54 +811,377 @@ int fan_speed_pid(float temperature, t_state_pid* state)
     return state->last_speed;
 }
 
-void mbpfan()
+//
+// Loop instrumentation
+//
+
+void log_loop_histograms()
 {
-    retrieve_settings(NULL);
+    for (int i = 0; i < LOOP_PHASES; i++) {
+        const t_histogram *histogram = &loop_histograms[i];
+
+        LOG("Latency %-9s: p50 %7.3f ms, p99 %7.3f ms, max %7.3f ms (%lu samples)",
+            loop_phase_names[i],
+            histogram_percentile(histogram, 0.5) / 1e6,
+            histogram_percentile(histogram, 0.99) / 1e6,
+            histogram->max / 1e6,
+            (unsigned long)histogram->total);
+    }
 
-    sensors = retrieve_sensors();
-    fans = retrieve_fans();
+    for (t_fans *fan = fans; fan != NULL; fan = fan->next) {
+        LOG("Fan %-9s: %lu writes, %lu suppressed", fan->name, fan->writes, fan->suppressed);
+    }
+}
 
-    set_fans_man(fans);
+//
+// Adaptive polling
+//
 
-    float temp = get_temp(sensors);
+void polling_init(t_state_polling* state, float start_temperature)
+{
+    state->interval_ms = polling_interval * 1000;
+    state->old_temp = start_temperature;
+    state->history = NULL;
+}
+
+int polling_next_interval(float temperature, t_state_polling* state)
+{
+    const float slope = state->history
+        ? history_slope(state->history)
+        : (temperature - state->old_temp) * 1000 / state->interval_ms;
+    const float temp_change = slope * state->interval_ms / 1000;
+    state->old_temp = temperature;
+
+    if (adaptive_polling_max == 0) {
+        state->interval_ms = polling_interval * 1000;
+
+    } else if (slope >= adaptive_polling_slope || temperature >= max_temp - adaptive_polling_margin) {
+        state->interval_ms = adaptive_polling_fast_ms;
+
+    } else if (fabsf(temp_change) < 1 && temperature <= low_temp - adaptive_polling_margin) {
+        // coretemp has 1C resolution, anything smaller is flat
+        state->interval_ms = max(state->interval_ms, polling_interval * 1000);
+        state->interval_ms = min(state->interval_ms * 2, adaptive_polling_max * 1000);
+
+    } else {
+        state->interval_ms = polling_interval * 1000;
+    }
+
+    return state->interval_ms;
+}
+
+// State of the control loop between two ticks
+static struct {
+    t_state_polling polling;
+    t_zone zones[MAX_ZONES];
+    int zones_used;
+    struct timespec last_sample;
+    bool use_alarms;
+    bool on_alarms;     // the alarm fds are in the event set
+    int timer_fd;
+    uint64_t deadline;  // ns, when the timer should fire
+    bool running;       // the event loop dispatches the ticks
+} loop;
+
+static void control_tick();
+
+static void on_timer(int fd, uint32_t events, void *data)
+{
+    (void)events;
+    (void)data;
+
+    uint64_t expirations;
+
+    if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;
+    }
+
+    const uint64_t now = monotonic_ns();
+    histogram_record(&loop_histograms[PHASE_OVERSLEEP], now > loop.deadline ? now - loop.deadline : 0);
+
+    control_tick();
+}
+
+static void unwatch_alarms()
+{
+    for (t_sensors *tmp = sensors; tmp != NULL; tmp = tmp->next) {
+        events_remove(tmp->alarm_fd);
+    }
+
+    restore_sensor_alarms(sensors);
+    loop.on_alarms = false;
+}
+
+static void on_alarm(int fd, uint32_t events, void *data)
+{
+    (void)fd;
+    (void)events;
+    (void)data;
+
+    unwatch_alarms();
+    control_tick();
+}
+
+// Return true if the loop now sleeps until a sensor crosses low_temp
+static bool watch_alarms()
+{
+    const int armed = arm_sensor_alarms(sensors, low_temp);
+
+    if (armed == 1) {
+        restore_sensor_alarms(sensors);
+        return false;
+    }
+
+    if (armed == 0) {
+        t_sensors *tmp = sensors;
+
+        while (tmp != NULL && events_add(tmp->alarm_fd, EPOLLPRI | EPOLLERR, on_alarm, NULL)) {
+            tmp = tmp->next;
+        }
+
+        if (tmp == NULL) {
+            loop.on_alarms = true;
+            return true;
+        }
+
+        unwatch_alarms();
+    }
+
+    restore_sensor_alarms(sensors);
+    LOG("Waiting on sensor alarms failed, using timed polling");
+    loop.use_alarms = false;
+    return false;
+}
+
+static void arm_timer(int interval_ms)
+{
+    struct itimerspec timer;
+    memset(&timer, 0, sizeof(timer));
+    timer.it_value.tv_sec = interval_ms / 1000;
+    timer.it_value.tv_nsec = (interval_ms % 1000) * 1000000L;
+
+    // a zero it_value would disarm the timer
+    if (interval_ms == 0) {
+        timer.it_value.tv_nsec = 1;
+    }
 
-    set_fan_speed(fans, min_fan_speed);
+    loop.deadline = monotonic_ns() + interval_ms * 1000000ULL;
+
+    if (timerfd_settime(loop.timer_fd, 0, &timer, NULL) == -1) {
+        FAIL("Could not arm the poll timer: %s", strerror(errno));
+    }
+}
+
+void poll_now()
+{
+    if (!loop.running) {
+        return;
+    }
+
+    if (loop.on_alarms) {
+        unwatch_alarms();
+    }
+
+    arm_timer(0);
+}
+
+static void control_tick()
+{
+    if (config_update()) {
+        loop.zones_used = zones_reload(loop.zones, loop.zones_used, sensors, fans);
+
+        if (temp_history.window != temp_window) {
+            history_init(&temp_history, temp_window);
+        }
+    }
+
+    t_zone *zones = loop.zones;
+    const int zones_used = loop.zones_used;
+
+    const uint64_t read_start = monotonic_ns();
+    refresh_sensors(sensors);
+    const uint64_t compute_start = monotonic_ns();
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    loop.polling.interval_ms = max(1, (now.tv_sec - loop.last_sample.tv_sec) * 1000 +
+                                      (now.tv_nsec - loop.last_sample.tv_nsec) / 1000000);
+    loop.last_sample = now;
+
+    const double now_s = now.tv_sec + now.tv_nsec / 1e9;
+    int speeds[MAX_FANS];
+    const float temp = zones_compute(zones, zones_used, now_s, speeds);
+    history_push(&temp_history, now_s, temp);
+
+    int fan_speed = 0;
+    bool hot = false;
+    for (int i = 0; i < zones_used; i++) {
+        fan_speed = max(fan_speed, zones[i].speed);
+        hot = hot || zones[i].temp > zones[i].config.thresholds.high_temp;
+    }
+
+    state_update(speeds, now_s);
+
+    const bool overridden = control_override(speeds, compute_start / 1000000);
+
+    const uint64_t write_start = monotonic_ns();
+    set_fan_speeds_at(fans, speeds, hot, write_start / 1000000);
+    const uint64_t write_end = monotonic_ns();
+
+    histogram_record(&loop_histograms[PHASE_READ], compute_start - read_start);
+    histogram_record(&loop_histograms[PHASE_COMPUTE], write_start - compute_start);
+    histogram_record(&loop_histograms[PHASE_WRITE], write_end - write_start);
+
+    telemetry_publish(read_start, temp, fan_speed, compute_start - read_start,
+                      write_start - compute_start, write_end - write_start);
+    journal_publish(temp, fan_speed);
 
     if(verbose) {
-        LOG("Sleeping for 2 seconds to get first temp delta.");
+        LOG("Temperature: %.1f C. Base Speed: %d RPM", temp, fan_speed);
+        LOG("Trend: EMA %.1f C, slope %+.2f C/s, last %d samples %.1f-%.1f C",
+            temp_history.ema, history_slope(&temp_history), history_len(&temp_history),
+            history_min(&temp_history), history_max(&temp_history));
+        for (int i = 0; zones_used > 1 && i < zones_used; i++) {
+            LOG("Zone %s: Temperature: %.1f C. Base Speed: %d RPM",
+                zones[i].config.name, zones[i].temp, zones[i].speed);
+        }
+        LOG("Sensors: %d read with %d syscalls (%s) in %ld us, %d passes",
+            sampler_stats.sensors, sampler_stats.syscalls,
+            sampler_active() ? "io_uring" : "pread", sampler_stats.nsec / 1000, sampler_stats.passes);
+        LOG("Loop: read %lu us, compute %lu us, write %lu us",
+            (unsigned long)(compute_start - read_start) / 1000,
+            (unsigned long)(write_start - compute_start) / 1000,
+            (unsigned long)(write_end - write_start) / 1000);
+
+        if (loop_histograms[PHASE_READ].total % 64 == 0) {
+            log_loop_histograms();
+        }
     }
-    sleep(2);
 
-    t_state_pid state_pid;
-    t_state_classic state_classic;
-    if (pid_values) {
-        fan_speed_pid_init(&state_pid);
-    } else {
-        fan_speed_classic_init(&state_classic, temp);
+    const int interval_ms = polling_next_interval(temp, &loop.polling);
+
+    // an override must not outlive its duration in an alarm wait
+    if (loop.use_alarms && !overridden && temp <= low_temp && fan_speed <= min_fan_speed) {
+        if (watch_alarms()) {
+            if(verbose) {
+                LOG("Sleeping until a sensor crosses %d C", low_temp);
+                fflush(stdout);
+            }
+            return;
+        }
+
+        // an alarm is already set, poll as usual and try again on a later tick
     }
 
-    while(1) {
+    if(verbose && adaptive_polling_max != 0) {
+        LOG("Next poll in %d ms", interval_ms);
+    }
 
-        temp = get_temp(sensors);
+    if(verbose) {
+        fflush(stdout);
+    }
 
-        const int fan_speed = pid_values
-            ? fan_speed_pid(temp, &state_pid)
-            : fan_speed_classic(temp, &state_classic);
+    arm_timer(interval_ms);
+}
 
-        if(verbose) {
-            LOG("Temperature: %.1f C. Base Speed: %d RPM", temp, fan_speed);
+void mbpfan()
+{
+    sensors = retrieve_sensors();
+    fans = retrieve_fans();
+
+    set_fans_man(fans);
+
+    float temp = get_temp(sensors);
+
+    clock_gettime(CLOCK_MONOTONIC, &loop.last_sample);
+
+    loop.zones_used = zones_init(loop.zones, sensors, fans);
+
+    char error[256];
+    int speeds[MAX_FANS];
+    const double now_s = loop.last_sample.tv_sec + loop.last_sample.tv_nsec / 1e9;
+
+    if (*state_path && state_restore(state_path, loop.zones, loop.zones_used, now_s, speeds, error, sizeof(error))) {
+        // a restart carries on where the previous daemon stopped
+        LOG("Resuming from the state saved in %s", state_path);
+        set_fan_speeds(fans, speeds);
+
+    } else {
+        if (*state_path && verbose) {
+            LOG("%s, starting cold", error);
         }
 
-        set_fan_speed(fans, fan_speed);
+        set_fan_speed(fans, min_fan_speed);
 
         if(verbose) {
-            fflush(stdout);
+            LOG("Sleeping for 2 seconds to get first temp delta.");
         }
+        sleep(2);
+    }
+
+    if (adaptive_polling_max != 0) {
+        // the default timer slack of 1s would swallow the fast interval
+        int err = prctl(PR_SET_TIMERSLACK, adaptive_polling_fast_ms * 1000L * 100, 0, 0, 0);
+        if (err == -1) {
+            perror("prctl");
+        }
+    }
+
+    loop.use_alarms = use_alarms && sensors_have_alarms(sensors);
+
+    if (use_alarms && !loop.use_alarms) {
+        LOG("Not all sensors support alarms, using timed polling");
+    }
 
-        // call nanosleep instead of sleep to avoid rt_sigprocmask and rt_sigaction
-        struct timespec ts;
-        ts.tv_sec = polling_interval;
-        ts.tv_nsec = 0;
-        nanosleep(&ts, NULL);
+    polling_init(&loop.polling, temp);
+    history_init(&temp_history, temp_window);
+    loop.polling.history = &temp_history;
+
+    loop.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+
+    if (loop.timer_fd == -1 || !events_init() || !events_add(loop.timer_fd, EPOLLIN, on_timer, NULL)) {
+        FAIL("Could not set up the event loop: %s", strerror(errno));
+    }
+
+    loop.running = true;
+
+    if (config_watch && !config_watch_start(settings_path)) {
+        LOG("Could not watch the configuration file: %s, reload it with SIGHUP", strerror(errno));
+    }
+
+    if (*control_socket && !control_start(control_socket, loop.zones, &loop.zones_used)) {
+        LOG("Could not open the control socket %s: %s", control_socket, strerror(errno));
+    }
+
+    if (*telemetry_shm && !telemetry_open(telemetry_shm)) {
+        LOG("Could not create the telemetry segment %s: %s", telemetry_shm, strerror(errno));
+    }
+
+    if (*metrics_listen && !metrics_start(metrics_listen)) {
+        LOG("Could not serve metrics on %s: %s", metrics_listen, strerror(errno));
     }
+
+    if (*journal_path && !journal_open(journal_path, (size_t)journal_size * 1024)) {
+        LOG("Could not open the journal %s: %s", journal_path, strerror(errno));
+    }
+
+    if (*state_path) {
+        state_start(state_path, loop.zones, &loop.zones_used);
+    }
+
+    control_tick();
+
+    // after the first tick, everything the loop keeps is allocated
+    if ((realtime_priority != 0 || housekeeping_cpu != -1) &&
+        !realtime_start(realtime_priority, housekeeping_cpu, error, sizeof(error))) {
+        LOG("%s", error);
+
+    } else if (realtime_priority != 0) {
+        LOG("Running the loop under SCHED_FIFO priority %d with its memory locked", realtime_priority);
+    }
+
+    while (events_dispatch(-1)) {
+    }
+
+    FAIL("Waiting for events failed: %s", strerror(errno));
 }
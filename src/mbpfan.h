@@ -17,10 +17,19 @@
 #ifndef _MBPFAN_H_
 #define _MBPFAN_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "histogram.h"
+#include "history.h"
+#include "filter.h"
+
 // Max number of supported fans
 #define MAX_FANS 10
 // Max number of fans to search in
 #define MAX_SEARCH_FANS 16
+// Max number of supported sensors
+#define MAX_SENSORS 64
 
 /** Basic fan speed parameters
  */
@@ -40,12 +49,76 @@ extern int max_temp;
  */
 extern int polling_interval;
 
-// Comma-delmited list of fan names, as set in the settings
-extern char* fan_list;
+/** Adaptive polling
+ *  adaptive_polling_max - longest interval in seconds while cool and flat, 0 disables
+ *  adaptive_polling_fast_ms - interval in ms while heating up or close to max_temp
+ *  adaptive_polling_slope - rate of rise in C/s that triggers the fast interval
+ *  adaptive_polling_margin - degrees below low_temp (idle) or max_temp (hot)
+ */
+extern int adaptive_polling_max;
+extern int adaptive_polling_fast_ms;
+extern float adaptive_polling_slope;
+extern int adaptive_polling_margin;
+
+/** Fan write suppression, to spare the SMC and stop the fans from hunting
+ *  fan_deadband - changes of up to this many RPM are not written
+ *  fan_dwell - minimum seconds between two speed changes of a fan
+ *  Both are bypassed when a fan is sent to its max_speed
+ */
+extern int fan_deadband;
+extern int fan_dwell;
+
+/** Sensor sampling backend
+ *  When true all sensors are read with a single io_uring submission,
+ *  falling back to one pread() per sensor if io_uring is unavailable
+ */
+extern bool use_io_uring;
+
+/** Root of the sysfs tree, "/sys" unless overridden by the sysfs_root
+ *  setting or the MBPFAN_SYSFS_ROOT environment variable.
+ *  applesmc_path is <sysfs_root>/devices/platform/applesmc.768 until
+ *  discovery_get() finds the applesmc hwmon device
+ */
+extern char sysfs_root[256];
+extern char applesmc_path[sizeof(sysfs_root) + 32];
+
+/** Latency histograms of the control loop phases, in ns
+ *  read - get_temp(), compute - the controller, write - set_fan_speed()
+ *  oversleep - time slept beyond the polling interval
+ *  Dumped to the log on SIGUSR1 and every 64 iterations when verbose
+ */
+enum { PHASE_READ, PHASE_COMPUTE, PHASE_WRITE, PHASE_OVERSLEEP, LOOP_PHASES };
+extern t_histogram loop_histograms[LOOP_PHASES];
+extern const char* loop_phase_names[LOOP_PHASES];
+
+/** Samples of the temperature driving the loop (the hottest zone),
+ *  temp_window - samples used for its slope, mean and extremes
+ */
+extern t_history temp_history;
+extern int temp_window;
+
+/** Comma-delimited list of hwmon drivers used as temperature input
+ *  Default is coretemp,k10temp
+ */
+extern char sensor_drivers[64];
+
+/** Alarm wakeups
+ *  When true and every sensor exposes a tempN_max_alarm with a writable
+ *  tempN_max, the daemon sleeps in poll() while below low_temp. tempN_max
+ *  is set back to its original value whenever the daemon wakes up.
+ *  Read at startup
+ */
+extern bool use_alarms;
+
+// Comma-delmited list of fan names, as set in the settings or discovered
+extern char fan_list[10 * MAX_FANS];
 extern float fan_ratios[MAX_FANS];
 extern int fan_min_speeds[MAX_FANS];
 extern int fan_max_speeds[MAX_FANS];
 
+// Kp, Ki and Kd, NULL unless PID control is enabled
+extern float* pid_values;
+
 /** Represents a Temperature sensor
  */
 struct s_sensors;
@@ -57,19 +130,34 @@ typedef struct s_fans t_fans;
 char *smprintf(const char *fmt, ...) __attribute__((format (printf, 1, 2)));
 
 /**
- * Return true if the kernel is < 3.15.0
+ * Return the CRC-32 (IEEE 802.3) of length bytes
  */
-bool is_legacy_sensors_path();
+uint32_t crc32(const void *data, size_t length);
+
+/**
+ * Prefix every hwmon and applesmc path with root
+ */
+void set_sysfs_root(const char* root);
+
+/**
+ * Set the sysfs root from MBPFAN_SYSFS_ROOT, or else from the sysfs_root
+ * key of the settings (/etc/mbpfan.conf if settings_path is NULL), and
+ * discovery_cache from its key of the same name. The default cache is
+ * only used with the /sys root.
+ * Must be called before any sensor or fan is detected
+ */
+void retrieve_sysfs_root(const char* settings_path);
 
 /**
  * Tries to use the settings located in
  * /etc/mbpfan.conf
  * If it fails, the default hardcoded settings are used
+ * Exits if the file is invalid, see config_reload() for hot reloads
  */
 void retrieve_settings(const char* settings_path);
 
 /**
- * Detect the sensors in /sys/devices/platform/coretemp.0/temp
+ * Detect the sensors of the sensor_drivers hwmon drivers in /sys/class/hwmon
  * Return a linked list of t_sensors (first temperature detected)
  */
 t_sensors *retrieve_sensors();
@@ -81,7 +169,25 @@ t_sensors *retrieve_sensors();
 t_sensors *refresh_sensors(t_sensors *sensors);
 
 /**
- * Detect the fans in /sys/devices/platform/applesmc.768/
+ * Return true if every sensor has an alarm with a programmable threshold
+ */
+bool sensors_have_alarms(t_sensors *sensors);
+
+/**
+ * Program the alarm threshold (in degrees) of every sensor and read the
+ * alarms, so a change is reported to pollers (POLLPRI) of their alarm_fd.
+ * Return 1 if an alarm is already set, 0 if armed, -1 if the alarms
+ * could not be used
+ */
+int arm_sensor_alarms(t_sensors *sensors, int threshold);
+
+/**
+ * Write back the tempN_max each sensor had before arm_sensor_alarms()
+ */
+void restore_sensor_alarms(t_sensors *sensors);
+
+/**
+ * Detect the fans in <sysfs_root>/devices/platform/applesmc.768/
  * Associate each fan to a sensor
  */
 t_fans* retrieve_fans();
@@ -89,14 +195,16 @@ t_fans* retrieve_fans();
 /**
  * Given a list of sensors with associated fans
  * Set them to manual control
+ * Return the number of fans that could not be switched
  */
-void set_fans_man(t_fans *fans);
+int set_fans_man(t_fans *fans);
 
 /**
  * Given a list of sensors with associated fans
  * Set them to automatic control
+ * Return the number of fans that could not be switched
  */
-void set_fans_auto(t_fans *fans);
+int set_fans_auto(t_fans *fans);
 
 /**
  * Given a list of sensors with associated fans
@@ -105,12 +213,130 @@ void set_fans_auto(t_fans *fans);
 void set_fan_speed(t_fans* fans, int speed);
 
 /**
- *  Return average CPU temp in degrees (ceiling)
+ * Same as set_fan_speed() with the time in ms used for fan_dwell,
+ * the fan writes and suppressions are counted in each fan.
+ * hot - the temperature is above high_temp, a rising speed is never held back
+ */
+void set_fan_speed_at(t_fans* fans, int speed, bool hot, long now_ms);
+
+/**
+ * Same as set_fan_speed() with a base speed for each fan of the list
+ */
+void set_fan_speeds(t_fans* fans, const int* speeds);
+
+void set_fan_speeds_at(t_fans* fans, const int* speeds, bool hot, long now_ms);
+
+/**
+ *  Return the CPU temp in degrees, aggregated as set by temp_aggregate
  */
 float get_temp(t_sensors* sensors);
 
 /**
- * Main Program
+ * Temperatures and speeds a controller works with
+ * pid_values - Kp, Ki and Kd, only used by the PID controller
+ */
+typedef struct
+{
+    int low_temp;
+    int high_temp;
+    int max_temp;
+    int min_fan_speed;
+    int max_fan_speed;
+    float pid_values[3];
+} t_thresholds;
+
+/**
+ * Fill thresholds with the [general] settings
+ */
+void settings_thresholds(t_thresholds* thresholds);
+
+// Slope in degrees per second the classic controller takes for a flat temperature
+#define CLASSIC_SLOPE_DEADBAND 0.005f
+
+/**
+ * "Classic" fan control state
+ */
+typedef struct
+{
+    t_thresholds limits;
+    const t_history* history; // trend of the temperature, NULL to compare the last two samples
+    int step_up;
+    int step_down;
+    int fan_speed;
+    int old_temp;
+} t_state_classic;
+
+/**
+ * Start the controller with the given thresholds,
+ * or with the [general] settings if thresholds is NULL
+ */
+void fan_speed_classic_init(t_state_classic* state, float start_temperature, const t_thresholds* thresholds);
+
+/**
+ * Return the base fan speed for the given temperature
+ */
+int fan_speed_classic(float temperature, t_state_classic* state);
+
+/**
+ * PID fan control state
+ */
+typedef struct
+{
+    t_thresholds limits;
+    const t_history* history; // slope used for the derivative term, NULL to use error_prior
+    const t_kalman* kalman;   // rate used for the derivative term instead of the history
+    float error_prior;
+    float integral;
+    int last_speed;
+    float interval; // seconds elapsed since the previous sample
+} t_state_pid;
+
+/**
+ * Start the controller with the given thresholds,
+ * or with the [general] settings if thresholds is NULL
+ */
+void fan_speed_pid_init(t_state_pid* state, const t_thresholds* thresholds);
+
+/**
+ * Return the base fan speed for the given temperature,
+ * state->interval must hold the time since the previous call
+ */
+int fan_speed_pid(float temperature, t_state_pid* state);
+
+typedef struct
+{
+    int interval_ms;
+    float old_temp;
+    const t_history* history; // slope used to detect a rise, NULL to use old_temp
+} t_state_polling;
+
+/**
+ * Start polling every polling_interval seconds
+ */
+void polling_init(t_state_polling* state, float start_temperature);
+
+/**
+ * Return the time in ms to sleep before the next sample.
+ * The interval doubles up to adaptive_polling_max while the temperature is
+ * flat and well below low_temp, and drops to adaptive_polling_fast_ms as soon
+ * as it rises quickly or gets close to max_temp
+ */
+int polling_next_interval(float temperature, t_state_polling* state);
+
+/**
+ * Log p50, p99 and max of every loop phase
+ */
+void log_loop_histograms();
+
+/**
+ * Run the next control tick right away, waking the loop from an alarm or
+ * a long poll interval, so new settings or commands take effect at once.
+ * Does nothing until mbpfan() runs the event loop
+ */
+void poll_now();
+
+/**
+ * Main Program, run once retrieve_settings() has read the settings
  */
 void mbpfan();
 
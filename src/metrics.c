@@ -0,0 +1,475 @@
+/**
+ *  metrics.c - OpenMetrics exporter for Prometheus style scrapers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  Notes:
+ *    A scrape is answered from the event loop with one HTTP/1.0 style
+ *    response, then the connection is closed. The page is rendered into a
+ *    static buffer: a scrape allocates nothing and costs one render.
+ *    A response the socket does not take at once is finished on EPOLLOUT,
+ *    scrapes arriving meanwhile are sent the same page instead of
+ *    rendering over it.
+ *    The latency buckets are the histogram bucket limits at each power
+ *    of two from 1 us to 17 s, written in exact decimal seconds, so every
+ *    cumulative count is exact.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "global.h"
+#include "mbpfan.h"
+#include "aggregate.h"
+#include "sampler.h"
+#include "config.h"
+#include "events.h"
+#include "metrics.h"
+
+char metrics_listen[108] = "";
+
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+    bool overflow;
+} t_page;
+
+typedef struct {
+    int fd;
+    size_t len;
+    char request[1024];
+    // response bytes sent, the page is pinned until it is sent whole
+    size_t sent;
+    bool sending;
+} t_scraper;
+
+// Latency buckets end at 2^bit - 1 ns for these bits
+#define LATENCY_FIRST_BIT 10
+#define LATENCY_LAST_BIT 34
+
+static int listen_fd = -1;
+static char unix_path[sizeof(metrics_listen)];
+static t_scraper scrapers[METRICS_MAX_CLIENTS];
+static char page[METRICS_PAGE_SIZE];
+static size_t page_length;
+static char header[160];
+static size_t header_length;
+static int senders = 0;
+
+static void emit(t_page *p, const char *fmt, ...)
+{
+    if (p->overflow) {
+        return;
+    }
+
+    va_list ap;
+    va_start(ap, fmt);
+    const int len = vsnprintf(p->buf + p->len, p->size - p->len, fmt, ap);
+    va_end(ap);
+
+    if (len < 0 || (size_t)len >= p->size - p->len) {
+        p->overflow = true;
+        return;
+    }
+
+    p->len += len;
+}
+
+// Append value as a quoted label value
+static void emit_label(t_page *p, const char *value)
+{
+    emit(p, "\"");
+
+    for (const char *c = value; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            emit(p, "\\%c", *c);
+        } else if (*c == '\n') {
+            emit(p, "\\n");
+        } else {
+            emit(p, "%c", *c);
+        }
+    }
+
+    emit(p, "\"");
+}
+
+// Append name and the labels identifying the index-th sensor
+static void emit_sensor(t_page *p, const char *name, int index, const t_sensors *sensor)
+{
+    emit(p, "%s{sensor=\"%d\",driver=", name, index);
+    emit_label(p, sensor->driver != NULL ? sensor->driver : "");
+    emit(p, ",label=");
+    emit_label(p, sensor->label);
+    emit(p, "}");
+}
+
+static void emit_family(t_page *p, const char *name, const char *type, const char *unit, const char *help)
+{
+    emit(p, "# TYPE %s %s\n", name, type);
+    if (unit != NULL) {
+        emit(p, "# UNIT %s %s\n", name, unit);
+    }
+    emit(p, "# HELP %s %s\n", name, help);
+}
+
+size_t metrics_render(char *buf, size_t size)
+{
+    t_page p = { buf, size, 0, false };
+
+    emit_family(&p, "mbpfan_temperature_celsius", "gauge", "celsius", "Temperature driving the control loop.");
+    emit(&p, "mbpfan_temperature_celsius %.3f\n",
+         history_len(&temp_history) > 0 ? history_last(&temp_history) : 0);
+
+    emit_family(&p, "mbpfan_sensor_temperature_celsius", "gauge", "celsius", "Temperature of each sensor.");
+    int index = 0;
+    for (t_sensors *sensor = sensors; sensor != NULL && index < sensor_samples.count; sensor = sensor->next, index++) {
+        emit_sensor(&p, "mbpfan_sensor_temperature_celsius", index, sensor);
+        emit(&p, " %.3f\n", sensor_samples.temp[index] / 1000.0);
+    }
+
+    emit_family(&p, "mbpfan_sensor_temperature_slope_celsius_per_second", "gauge", NULL,
+                "Least squares trend of each sensor over temp_window samples.");
+    index = 0;
+    for (t_sensors *sensor = sensors; sensor != NULL && index < sensor_samples.count; sensor = sensor->next, index++) {
+        emit_sensor(&p, "mbpfan_sensor_temperature_slope_celsius_per_second", index, sensor);
+        emit(&p, " %.4f\n", history_slope(&sensor_history[index]));
+    }
+
+    emit_family(&p, "mbpfan_sensor_temperature_min_celsius", "gauge", "celsius",
+                "Lowest temperature of each sensor over temp_window samples.");
+    index = 0;
+    for (t_sensors *sensor = sensors; sensor != NULL && index < sensor_samples.count; sensor = sensor->next, index++) {
+        emit_sensor(&p, "mbpfan_sensor_temperature_min_celsius", index, sensor);
+        emit(&p, " %.3f\n", history_min(&sensor_history[index]));
+    }
+
+    emit_family(&p, "mbpfan_sensor_temperature_max_celsius", "gauge", "celsius",
+                "Highest temperature of each sensor over temp_window samples.");
+    index = 0;
+    for (t_sensors *sensor = sensors; sensor != NULL && index < sensor_samples.count; sensor = sensor->next, index++) {
+        emit_sensor(&p, "mbpfan_sensor_temperature_max_celsius", index, sensor);
+        emit(&p, " %.3f\n", history_max(&sensor_history[index]));
+    }
+
+    emit_family(&p, "mbpfan_sensor_read_errors", "counter", NULL, "Failed sensor reads.");
+    emit(&p, "mbpfan_sensor_read_errors_total %lu\n", sampler_stats.read_errors);
+
+    emit_family(&p, "mbpfan_fan_target_rpm", "gauge", NULL, "Speed last written to each fan.");
+    for (t_fans *fan = fans; fan != NULL; fan = fan->next) {
+        emit(&p, "mbpfan_fan_target_rpm{fan=");
+        emit_label(&p, fan->name);
+        emit(&p, "} %d\n", fan->old_speed);
+    }
+
+    emit_family(&p, "mbpfan_fan_writes", "counter", NULL, "Fan speed writes issued.");
+    for (t_fans *fan = fans; fan != NULL; fan = fan->next) {
+        emit(&p, "mbpfan_fan_writes_total{fan=");
+        emit_label(&p, fan->name);
+        emit(&p, "} %lu\n", fan->writes);
+    }
+
+    emit_family(&p, "mbpfan_fan_writes_suppressed", "counter", NULL,
+                "Fan speed changes held back by fan_deadband and fan_dwell.");
+    for (t_fans *fan = fans; fan != NULL; fan = fan->next) {
+        emit(&p, "mbpfan_fan_writes_suppressed_total{fan=");
+        emit_label(&p, fan->name);
+        emit(&p, "} %lu\n", fan->suppressed);
+    }
+
+    emit_family(&p, "mbpfan_loop_phase_seconds", "histogram", "seconds",
+                "Duration of the control loop phases, oversleep is the poll timer lateness.");
+    for (int phase = 0; phase < LOOP_PHASES; phase++) {
+        const t_histogram *h = &loop_histograms[phase];
+
+        uint64_t count = 0;
+        int bit = LATENCY_FIRST_BIT;
+
+        for (int i = 0; i < HISTOGRAM_BUCKETS && bit <= LATENCY_LAST_BIT; i++) {
+            const uint64_t limit = histogram_bucket_limit(i);
+            count += h->counts[i];
+
+            if (limit == (1ULL << bit) - 1) {
+                emit(&p, "mbpfan_loop_phase_seconds_bucket{phase=\"%s\",le=\"%lu.%09lu\"} %lu\n",
+                     loop_phase_names[phase], (unsigned long)(limit / 1000000000),
+                     (unsigned long)(limit % 1000000000), (unsigned long)count);
+                bit++;
+            }
+        }
+        emit(&p, "mbpfan_loop_phase_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %lu\n",
+             loop_phase_names[phase], (unsigned long)h->total);
+        emit(&p, "mbpfan_loop_phase_seconds_count{phase=\"%s\"} %lu\n", loop_phase_names[phase], (unsigned long)h->total);
+        emit(&p, "mbpfan_loop_phase_seconds_sum{phase=\"%s\"} %.9f\n", loop_phase_names[phase], h->sum / 1e9);
+    }
+
+    emit_family(&p, "mbpfan_reloads", "counter", NULL, "Configuration reloads applied.");
+    emit(&p, "mbpfan_reloads_total %lu\n", config_reloads);
+
+    emit_family(&p, "mbpfan_reload_failures", "counter", NULL, "Configuration reloads rejected.");
+    emit(&p, "mbpfan_reload_failures_total %lu\n", config_reload_failures);
+
+    emit(&p, "# EOF\n");
+
+    return p.overflow ? 0 : p.len;
+}
+
+static void drop_scraper(t_scraper *scraper)
+{
+    if (scraper->sending) {
+        scraper->sending = false;
+        senders--;
+    }
+
+    events_remove(scraper->fd);
+    close(scraper->fd);
+    scraper->fd = -1;
+}
+
+static void on_writable(int fd, uint32_t events, void *data);
+
+// Send what is left of the response, wait for EPOLLOUT if the socket is full
+static void send_response(t_scraper *scraper)
+{
+    const size_t total = header_length + page_length;
+
+    while (scraper->sent < total) {
+        struct iovec iov[2];
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = iov;
+
+        if (scraper->sent < header_length) {
+            iov[0] = (struct iovec) { header + scraper->sent, header_length - scraper->sent };
+            iov[1] = (struct iovec) { page, page_length };
+            message.msg_iovlen = 2;
+        } else {
+            iov[0] = (struct iovec) { page + scraper->sent - header_length, total - scraper->sent };
+            message.msg_iovlen = 1;
+        }
+
+        const ssize_t len = sendmsg(scraper->fd, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+        if (len > 0) {
+            scraper->sent += len;
+            continue;
+        }
+
+        if (len == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if (len == -1 && errno == EAGAIN) {
+            if (scraper->sending) {
+                return;
+            }
+
+            events_remove(scraper->fd);
+            if (events_add(scraper->fd, EPOLLOUT, on_writable, scraper)) {
+                scraper->sending = true;
+                senders++;
+                return;
+            }
+        }
+
+        // a truncated page must not pass for a whole one
+        break;
+    }
+
+    drop_scraper(scraper);
+}
+
+static void on_writable(int fd, uint32_t events, void *data)
+{
+    (void)fd;
+
+    t_scraper *scraper = data;
+
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        drop_scraper(scraper);
+        return;
+    }
+
+    send_response(scraper);
+}
+
+static void respond(t_scraper *scraper)
+{
+    // a page still being sent is served again rather than rendered over
+    if (senders == 0) {
+        page_length = metrics_render(page, sizeof(page));
+
+        if (page_length == 0) {
+            header_length = snprintf(header, sizeof(header),
+                                     "HTTP/1.0 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n");
+        } else {
+            header_length = snprintf(header, sizeof(header),
+                                     "HTTP/1.0 200 OK\r\n"
+                                     "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                                     "Content-Length: %zu\r\n\r\n", page_length);
+        }
+    }
+
+    scraper->sent = 0;
+    send_response(scraper);
+}
+
+static void on_scraper(int fd, uint32_t events, void *data)
+{
+    (void)events;
+
+    t_scraper *scraper = data;
+    ssize_t len;
+
+    while ((len = read(fd, scraper->request + scraper->len, sizeof(scraper->request) - 1 - scraper->len)) > 0) {
+        scraper->len += len;
+        scraper->request[scraper->len] = '\0';
+
+        // answer once the headers are complete, the request itself does not matter
+        if (strstr(scraper->request, "\r\n\r\n") != NULL || strstr(scraper->request, "\n\n") != NULL ||
+            scraper->len == sizeof(scraper->request) - 1) {
+            respond(scraper);
+            return;
+        }
+    }
+
+    if (len == 0 || errno != EAGAIN) {
+        drop_scraper(scraper);
+    }
+}
+
+static void on_connect(int fd, uint32_t events, void *data)
+{
+    (void)events;
+    (void)data;
+
+    int client_fd;
+
+    while ((client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        t_scraper *scraper = NULL;
+
+        for (int i = 0; i < METRICS_MAX_CLIENTS && scraper == NULL; i++) {
+            if (scrapers[i].fd == -1) {
+                scraper = &scrapers[i];
+            }
+        }
+
+        if (scraper == NULL || !events_add(client_fd, EPOLLIN, on_scraper, scraper)) {
+            close(client_fd);
+            continue;
+        }
+
+        scraper->fd = client_fd;
+        scraper->len = 0;
+        scraper->sending = false;
+    }
+}
+
+bool metrics_start(const char *address)
+{
+    int bound;
+
+    for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+        scrapers[i].fd = -1;
+        scrapers[i].sending = false;
+    }
+    senders = 0;
+
+    if (*address == '/') {
+        struct sockaddr_un un;
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        snprintf(un.sun_path, sizeof(un.sun_path), "%s", address);
+
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd == -1) {
+            return false;
+        }
+
+        unlink(address);
+        snprintf(unix_path, sizeof(unix_path), "%s", address);
+        bound = bind(listen_fd, (struct sockaddr *)&un, sizeof(un));
+
+    } else {
+        char *end;
+        const long port = strtol(address, &end, 10);
+
+        if (*end != '\0' || port <= 0 || port > 65535) {
+            errno = EINVAL;
+            return false;
+        }
+
+        struct sockaddr_in in;
+        memset(&in, 0, sizeof(in));
+        in.sin_family = AF_INET;
+        in.sin_port = htons(port);
+        // metrics are for the node agent, never expose them to the network
+        in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd == -1) {
+            return false;
+        }
+
+        const int reuse = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        bound = bind(listen_fd, (struct sockaddr *)&in, sizeof(in));
+    }
+
+    if (bound == -1 || listen(listen_fd, METRICS_MAX_CLIENTS) == -1 ||
+        !events_add(listen_fd, EPOLLIN, on_connect, NULL)) {
+        const int saved = errno;
+        close(listen_fd);
+        listen_fd = -1;
+        errno = saved;
+        return false;
+    }
+
+    if (verbose) {
+        LOG("Serving metrics on %s", address);
+    }
+
+    return true;
+}
+
+void metrics_stop()
+{
+    if (listen_fd == -1) {
+        return;
+    }
+
+    for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+        if (scrapers[i].fd != -1) {
+            drop_scraper(&scrapers[i]);
+        }
+    }
+
+    events_remove(listen_fd);
+    close(listen_fd);
+    listen_fd = -1;
+
+    if (*unix_path) {
+        unlink(unix_path);
+    }
+}
@@ -0,0 +1,48 @@
+/**
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define METRICS_MAX_CLIENTS 4
+// Largest rendered page, enough for MAX_SENSORS sensors and MAX_FANS fans
+#define METRICS_PAGE_SIZE 65536
+
+/** Where the OpenMetrics exporter listens, empty to disable (the default)
+ *  "/path" - UNIX socket
+ *  "port" - TCP port on 127.0.0.1
+ */
+extern char metrics_listen[108];
+
+/**
+ * Render every metric in the OpenMetrics text format into page, ending
+ * with "# EOF". Return the length, or 0 if it does not fit
+ */
+size_t metrics_render(char *page, size_t size);
+
+/**
+ * Serve metrics_render() over HTTP on the given address (see
+ * metrics_listen) from the event loop. Needs events_init().
+ * Return false if the socket could not be created
+ */
+bool metrics_start(const char *address);
+
+/**
+ * Close the exporter socket, and remove it if it is a UNIX socket
+ */
+void metrics_stop();
+
+#endif
@@ -14,12 +14,37 @@ extern int tests_run;
 
 static const char *test_sensor_paths();
 static const char *test_fan_paths();
+static const char *test_hwmon_discover();
 static const char *test_get_temp();
 static const char *test_config_file();
 static const char *test_settings();
 static void handler(int signal);
 static const char *test_sighup_receive();
 static const char *test_settings_reload();
+static const char *test_adaptive_polling();
+static const char *test_io_uring_sampler();
+static const char *test_sensor_alarms();
+static const char *test_fake_sysfs_discovery();
+static const char *test_fake_sysfs_control();
+static const char *test_history();
+static const char *test_filter();
+static const char *test_aggregation();
+static const char *test_zones();
+static const char *test_config_reload();
+static const char *test_zones_reload();
+static const char *test_control_requests();
+static const char *test_telemetry();
+static const char *test_metrics();
+static const char *test_journal();
+static const char *test_replay();
+static const char *test_state();
+static const char *test_discovery_cache();
+static const char *test_realtime_settings();
+static const char *test_simulator();
+static const char *test_histogram();
+static const char *test_fan_write_suppression();
+static const char *hermetic_suite();
+static const char *hermetic_tests();
 static const char *all_tests();
 
 int tests();
@@ -0,0 +1,116 @@
+/**
+ *  realtime.c - real-time scheduling of the control loop
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  Notes:
+ *    SCHED_FIFO rather than SCHED_DEADLINE: the adaptive polling changes
+ *    the period of the loop at every tick, and a deadline reservation is
+ *    sized for a fixed one. A tick takes well under a millisecond, so a
+ *    low FIFO priority is enough to preempt any SCHED_OTHER build job.
+ *    Memory is locked after the first tick, by then the sensors, fans,
+ *    zones, stdio buffers and every optional feature have allocated what
+ *    they keep. glibc is told to never give freed memory back, so a later
+ *    allocation reuses locked pages instead of faulting new ones in.
+ *    The wakeup lateness is the oversleep phase of the loop histograms,
+ *    reset when SCHED_FIFO takes effect so the startup wakeups under
+ *    SCHED_OTHER are not counted. The reset happens before the loop
+ *    serves a scrape, no exported counter is seen going backwards.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <malloc.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "global.h"
+#include "mbpfan.h"
+#include "histogram.h"
+#include "realtime.h"
+
+int realtime_priority = 0;
+int housekeeping_cpu = -1;
+
+static int active_priority = 0;
+
+// Fault in the stack the loop will use, so a deep tick never page faults
+static void __attribute__((noinline)) prefault_stack()
+{
+    volatile char stack[REALTIME_STACK_PREFAULT];
+    memset((char *)stack, 0, sizeof(stack));
+}
+
+bool realtime_start(int priority, int cpu, char *error, size_t size)
+{
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+
+        if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+            snprintf(error, size, "Could not pin the daemon to CPU %d: %s", cpu, strerror(errno));
+            return false;
+        }
+    }
+
+    if (priority == 0) {
+        return true;
+    }
+
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+        snprintf(error, size, "Could not lock the daemon in memory: %s", strerror(errno));
+        return false;
+    }
+
+    prefault_stack();
+
+    struct sched_param param = { .sched_priority = priority };
+
+    if (sched_setscheduler(0, SCHED_FIFO | SCHED_RESET_ON_FORK, &param) == -1) {
+        snprintf(error, size, "Could not switch to SCHED_FIFO priority %d: %s", priority, strerror(errno));
+        return false;
+    }
+
+    histogram_reset(&loop_histograms[PHASE_OVERSLEEP]);
+    active_priority = priority;
+    return true;
+}
+
+int realtime_active()
+{
+    return active_priority;
+}
+
+void realtime_stop()
+{
+    if (active_priority == 0) {
+        return;
+    }
+
+    const t_histogram *histogram = &loop_histograms[PHASE_OVERSLEEP];
+
+    LOG("Wakeup lateness under SCHED_FIFO: p50 %.3f ms, p99 %.3f ms, max %.3f ms (%lu wakeups)",
+        histogram_percentile(histogram, 0.5) / 1e6,
+        histogram_percentile(histogram, 0.99) / 1e6,
+        histogram->max / 1e6,
+        (unsigned long)histogram->total);
+
+    active_priority = 0;
+}
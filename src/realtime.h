@@ -0,0 +1,56 @@
+/**
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _REALTIME_H_
+#define _REALTIME_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Highest priority accepted, the loop has no business above kernel threads
+#define REALTIME_MAX_PRIORITY 49
+// CPUs a cpu_set_t holds
+#define REALTIME_MAX_CPUS 1024
+// Stack touched before locking it, well above the deepest tick
+#define REALTIME_STACK_PREFAULT (128 * 1024)
+
+/** SCHED_FIFO priority of the control loop, 0 to keep SCHED_OTHER (the default)
+ *  Read at startup
+ */
+extern int realtime_priority;
+
+/** CPU the daemon is pinned to, -1 to let it run anywhere (the default)
+ *  Read at startup
+ */
+extern int housekeeping_cpu;
+
+/**
+ * Pin the daemon to cpu unless it is -1, keep freed memory mapped, lock
+ * and prefault its memory, and switch it to SCHED_FIFO at priority, from
+ * which the oversleep histogram starts over.
+ * Called once everything is allocated. Return false with the failed step
+ * in error, the steps already done are kept
+ */
+bool realtime_start(int priority, int cpu, char *error, size_t size);
+
+/**
+ * Return the SCHED_FIFO priority set by realtime_start(), 0 if none
+ */
+int realtime_active();
+
+/**
+ * Log the wakeup lateness measured under SCHED_FIFO, if it was set
+ */
+void realtime_stop();
+
+#endif
@@ -0,0 +1,289 @@
+/**
+ *  replay.c - run the controllers over recorded temperature traces
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  Notes:
+ *    The replay is open loop: the controllers see the recorded driving
+ *    temperature at the recorded times, whatever speed they ask for.
+ *    It tells how a configuration would have reacted to a real workload,
+ *    while the simulator (-s) tells how the machine reacts to the fans.
+ *    Only the [general] controller is replayed, zones and sensor
+ *    selection do not apply to the driving temperature of a trace.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <syslog.h>
+#include <stdbool.h>
+#include "mbpfan.h"
+#include "global.h"
+#include "config.h"
+#include "journal.h"
+#include "simulator.h"
+#include "replay.h"
+
+/* lazy min/max... */
+#define min(a,b) ((a) < (b) ? (a) : (b))
+#define max(a,b) ((a) > (b) ? (a) : (b))
+
+typedef struct {
+    t_replay_point *points;
+    int count;
+    int size;
+    int fan_count;
+} t_trace;
+
+static void trace_push(t_trace *trace, const t_replay_point *point)
+{
+    if (trace->count == trace->size) {
+        trace->size = trace->size > 0 ? trace->size * 2 : 1024;
+        trace->points = realloc(trace->points, trace->size * sizeof(t_replay_point));
+    }
+
+    trace->points[trace->count++] = *point;
+}
+
+static bool trace_visit(const t_journal_record *record, void *data)
+{
+    t_trace *trace = data;
+    t_replay_point point;
+
+    point.time = record->time_ms / 1000.0;
+    point.temp = record->temp / 1000.0f;
+    point.fan_speed = record->fan_speed;
+    trace->fan_count = max(trace->fan_count, record->fan_count);
+    trace_push(trace, &point);
+    return true;
+}
+
+int replay_load_trace(const char *path, t_replay_point **points, int *fan_count)
+{
+    t_trace trace;
+    memset(&trace, 0, sizeof(trace));
+
+    if (journal_read(path, trace_visit, &trace) == -1) {
+        FILE *file = fopen(path, "r");
+
+        if (file == NULL) {
+            return 0;
+        }
+
+        char line[1024];
+
+        while (fgets(line, sizeof(line), file) != NULL) {
+            t_replay_point point;
+
+            if (line[0] == '#' || sscanf(line, "%lf,%f", &point.time, &point.temp) != 2) {
+                continue;
+            }
+
+            if (sscanf(line, "%*f,%*f,%d", &point.fan_speed) != 1) {
+                point.fan_speed = -1;
+            }
+
+            trace_push(&trace, &point);
+        }
+
+        fclose(file);
+    }
+
+    if (trace.count == 0) {
+        free(trace.points);
+        trace.points = NULL;
+    }
+
+    *points = trace.points;
+    *fan_count = min(max(trace.fan_count, 1), MAX_FANS);
+    return trace.count;
+}
+
+void replay_run(const t_replay_point *points, int count, int fan_count, int *speeds, t_replay_result *result)
+{
+    memset(result, 0, sizeof(*result));
+    result->ticks = count;
+    result->duration = count > 0 ? points[count - 1].time - points[0].time : 0;
+
+    t_fans *replay_fans = sim_fans(fan_count);
+
+    t_state_classic state_classic;
+    t_state_pid state_pid;
+    t_history history;
+    t_kalman kalman;
+
+    double speed_sum = 0;
+    double diff_sum = 0;
+    int compared = 0;
+
+    for (int i = 0; i < count; i++) {
+        const double time = points[i].time;
+        // a tick holds until the next one
+        const double span = i + 1 < count ? points[i + 1].time - time : 0;
+        const float temp = points[i].temp;
+        float filtered = temp;
+
+        if (i == 0) {
+            if (pid_values) {
+                fan_speed_pid_init(&state_pid, NULL);
+            } else {
+                fan_speed_classic_init(&state_classic, temp, NULL);
+            }
+            history_init(&history, temp_window);
+            kalman_init(&kalman);
+            state_pid.history = &history;
+            state_pid.kalman = kalman_enabled() ? &kalman : NULL;
+            state_classic.history = &history;
+
+        } else {
+            state_pid.interval = time - points[i - 1].time;
+        }
+
+        if (kalman_enabled()) {
+            filtered = kalman_update(&kalman, time, temp);
+        }
+
+        history_push(&history, time, filtered);
+
+        const int fan_speed = pid_values
+            ? fan_speed_pid(filtered, &state_pid)
+            : fan_speed_classic(filtered, &state_classic);
+        speeds[i] = fan_speed;
+
+        set_fan_speed_at(replay_fans, fan_speed, filtered > high_temp, time * 1000);
+
+        const double ratio = (double)fan_speed / max_fan_speed;
+        speed_sum += fan_speed * span;
+        result->fan_power += ratio * ratio * ratio * span;
+        result->peak_speed = max(result->peak_speed, fan_speed);
+
+        if (fan_speed >= max_fan_speed) {
+            result->time_at_max += span;
+        }
+
+        if (points[i].fan_speed >= 0) {
+            const int diff = abs(fan_speed - points[i].fan_speed);
+            diff_sum += diff;
+            result->max_diff = max(result->max_diff, diff);
+            compared++;
+        }
+    }
+
+    if (result->duration > 0) {
+        result->mean_speed = speed_sum / result->duration;
+        result->fan_power /= result->duration;
+    } else if (count > 0) {
+        const double ratio = (double)speeds[0] / max_fan_speed;
+        result->mean_speed = speeds[0];
+        result->fan_power = ratio * ratio * ratio;
+    }
+
+    result->mean_diff = compared > 0 ? diff_sum / compared : 0;
+
+    for (t_fans *fan = replay_fans; fan != NULL; fan = fan->next) {
+        result->fan_changes += fan->writes;
+        result->fan_suppressed += fan->suppressed;
+    }
+
+    free_sim_fans(replay_fans);
+}
+
+int replay(const char *trace, char *const *configs, int config_count)
+{
+    t_replay_point *points = NULL;
+    int fan_count;
+    const int count = replay_load_trace(trace, &points, &fan_count);
+
+    if (count == 0) {
+        fprintf(stderr, "Could not read trace '%s'\n", trace);
+        return 1;
+    }
+
+    char *default_config[] = { (char *)(settings_path != NULL ? settings_path : "/etc/mbpfan.conf") };
+
+    if (config_count == 0) {
+        configs = default_config;
+        config_count = 1;
+    }
+
+    // every configuration starts from the built-in defaults
+    static t_config defaults;
+    static t_config config;
+    config_capture(&defaults);
+
+    int *speeds = malloc((size_t)count * config_count * sizeof(int));
+    t_replay_result *results = malloc(config_count * sizeof(t_replay_result));
+    bool *pid = malloc(config_count * sizeof(bool));
+
+    // stdout is the CSV series, the per tick logs of the controllers stay off
+    const int saved_verbose = verbose;
+    verbose = 0;
+
+    for (int c = 0; c < config_count; c++) {
+        char error[256];
+        config = defaults;
+
+        if (!config_read(configs[c], &config, error, sizeof(error)) ||
+            !config_validate(&config, error, sizeof(error))) {
+            fprintf(stderr, "Could not read configuration '%s': %s\n", configs[c], error);
+            verbose = saved_verbose;
+            free(speeds);
+            free(results);
+            free(pid);
+            free(points);
+            return 1;
+        }
+
+        config_apply(&config);
+        pid[c] = pid_values != NULL;
+        replay_run(points, count, fan_count, speeds + (size_t)c * count, &results[c]);
+    }
+
+    verbose = saved_verbose;
+
+    printf("# time,temp,recorded");
+    for (int c = 0; c < config_count; c++) {
+        printf(",%s", configs[c]);
+    }
+    printf("\n");
+
+    for (int i = 0; i < count; i++) {
+        printf("%.3f,%.3f,%d", points[i].time, points[i].temp, points[i].fan_speed);
+
+        for (int c = 0; c < config_count; c++) {
+            printf(",%d", speeds[(size_t)c * count + i]);
+        }
+        printf("\n");
+    }
+
+    printf("# Trace:           %d ticks over %.0f s\n", count, results[0].duration);
+
+    for (int c = 0; c < config_count; c++) {
+        const t_replay_result *result = &results[c];
+
+        printf("# %s\n", configs[c]);
+        printf("#   Controller:    %s\n", pid[c] ? "PID" : "classic");
+        printf("#   Mean speed:    %.0f RPM\n", result->mean_speed);
+        printf("#   Peak speed:    %d RPM\n", result->peak_speed);
+        printf("#   At max speed:  %.1f s\n", result->time_at_max);
+        printf("#   Fan power:     %.1f%% of maximum\n", result->fan_power * 100);
+        printf("#   Fan changes:   %d (%d suppressed)\n", result->fan_changes, result->fan_suppressed);
+        printf("#   Vs recorded:   %.0f RPM mean, %d RPM max difference\n", result->mean_diff, result->max_diff);
+    }
+
+    free(speeds);
+    free(results);
+    free(pid);
+    free(points);
+    return 0;
+}
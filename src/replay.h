@@ -0,0 +1,70 @@
+/**
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _REPLAY_H_
+#define _REPLAY_H_
+
+/** A tick of a recorded trace
+ *  time - seconds
+ *  temp - temperature that drove the loop, degrees
+ *  fan_speed - base speed the daemon asked for, -1 if not recorded
+ */
+typedef struct {
+    double time;
+    float temp;
+    int fan_speed;
+} t_replay_point;
+
+/** Outcome of a replay, speeds are base speeds in RPM
+ *  mean_speed, fan_power - averaged over time, fan_power is the fraction of
+ *                          the power the fans draw at max_fan_speed
+ *  time_at_max - seconds spent at max_fan_speed
+ *  fan_changes, fan_suppressed - speed writes of all fans, issued and
+ *                                held back by fan_deadband/fan_dwell
+ *  mean_diff, max_diff - absolute difference with the recorded speeds
+ */
+typedef struct {
+    int ticks;
+    double duration;
+    double mean_speed;
+    int peak_speed;
+    double time_at_max;
+    double fan_power;
+    int fan_changes;
+    int fan_suppressed;
+    double mean_diff;
+    int max_diff;
+} t_replay_result;
+
+/**
+ * Read a trace from a journal file or from CSV lines "time,temp[,fan_speed]",
+ * the output of --dump-journal. fan_count is set to the number of fans
+ * recorded, 1 if unknown.
+ * Return the number of points, 0 on failure. The caller frees *points
+ */
+int replay_load_trace(const char *path, t_replay_point **points, int *fan_count);
+
+/**
+ * Run the controller selected by the current settings over the recorded
+ * temperatures, open loop, and store the base speed of each tick in speeds
+ */
+void replay_run(const t_replay_point *points, int count, int fan_count, int *speeds, t_replay_result *result);
+
+/**
+ * Replay the trace with each configuration file, print the speeds of every
+ * tick as CSV followed by the metrics of each configuration.
+ * Return 0 on success
+ */
+int replay(const char *trace, char *const *configs, int config_count);
+
+#endif
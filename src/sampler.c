@@ -0,0 +1,340 @@
+/**
+ *  sampler.c - batched sensor sampling through io_uring
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  Notes:
+ *    liburing is not required, the ring is set up with the raw syscalls.
+ *    All sensor fds are registered once, every refresh is then a single
+ *    io_uring_enter() submitting one read per sensor and waiting for all
+ *    of them. A short submission is completed by further calls. If the
+ *    ring stops making progress the reads in flight are drained and the
+ *    ring is torn down, the sensors are then read with pread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "global.h"
+#include "sampler.h"
+
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#define HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#endif
+
+#define SAMPLE_BUF_SIZE 16
+// Calls to io_uring_enter() in a row making no progress before giving up
+#define SAMPLER_MAX_STALLS 8
+
+t_sampler_stats sampler_stats;
+
+#ifdef HAVE_IO_URING
+
+static struct {
+    int ring_fd;
+    unsigned entries;
+
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    t_sensors **sensors;
+    char (*bufs)[SAMPLE_BUF_SIZE];
+} ring = { .ring_fd = -1 };
+
+static void ring_unmap()
+{
+    if (ring.sqes != NULL) {
+        munmap(ring.sqes, ring.sqes_size);
+    }
+
+    if (ring.cq_ptr != NULL && ring.cq_ptr != ring.sq_ptr) {
+        munmap(ring.cq_ptr, ring.cq_size);
+    }
+
+    if (ring.sq_ptr != NULL) {
+        munmap(ring.sq_ptr, ring.sq_size);
+    }
+
+    if (ring.ring_fd != -1) {
+        close(ring.ring_fd);
+    }
+
+    free(ring.sensors);
+    free(ring.bufs);
+
+    memset(&ring, 0, sizeof(ring));
+    ring.ring_fd = -1;
+}
+
+bool sampler_init(t_sensors *sensors)
+{
+    unsigned count = 0;
+    t_sensors *tmp;
+
+    sampler_close();
+
+    for (tmp = sensors; tmp != NULL; tmp = tmp->next) {
+        if (tmp->file != NULL) {
+            count++;
+        }
+    }
+
+    if (count == 0) {
+        return false;
+    }
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring.ring_fd = syscall(__NR_io_uring_setup, count, &params);
+
+    if (ring.ring_fd < 0) {
+        ring.ring_fd = -1;
+        return false;
+    }
+
+    ring.entries = count;
+    ring.sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring.cq_size > ring.sq_size) {
+            ring.sq_size = ring.cq_size;
+        }
+
+        ring.cq_size = ring.sq_size;
+    }
+
+    ring.sq_ptr = mmap(NULL, ring.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring.ring_fd, IORING_OFF_SQ_RING);
+
+    if (ring.sq_ptr == MAP_FAILED) {
+        ring.sq_ptr = NULL;
+        ring_unmap();
+        return false;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring.cq_ptr = ring.sq_ptr;
+
+    } else {
+        ring.cq_ptr = mmap(NULL, ring.cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           ring.ring_fd, IORING_OFF_CQ_RING);
+
+        if (ring.cq_ptr == MAP_FAILED) {
+            ring.cq_ptr = NULL;
+            ring_unmap();
+            return false;
+        }
+    }
+
+    ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     ring.ring_fd, IORING_OFF_SQES);
+
+    if (ring.sqes == MAP_FAILED) {
+        ring.sqes = NULL;
+        ring_unmap();
+        return false;
+    }
+
+    ring.sq_tail = (unsigned *)((char *)ring.sq_ptr + params.sq_off.tail);
+    ring.sq_mask = (unsigned *)((char *)ring.sq_ptr + params.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)((char *)ring.sq_ptr + params.sq_off.array);
+    ring.cq_head = (unsigned *)((char *)ring.cq_ptr + params.cq_off.head);
+    ring.cq_tail = (unsigned *)((char *)ring.cq_ptr + params.cq_off.tail);
+    ring.cq_mask = (unsigned *)((char *)ring.cq_ptr + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)((char *)ring.cq_ptr + params.cq_off.cqes);
+
+    ring.sensors = malloc(count * sizeof(*ring.sensors));
+    ring.bufs = malloc(count * sizeof(*ring.bufs));
+    int fds[count];
+    unsigned i = 0;
+
+    for (tmp = sensors; tmp != NULL; tmp = tmp->next) {
+        if (tmp->file != NULL) {
+            ring.sensors[i] = tmp;
+            fds[i] = fileno(tmp->file);
+            i++;
+        }
+    }
+
+    if (syscall(__NR_io_uring_register, ring.ring_fd, IORING_REGISTER_FILES, fds, count) < 0) {
+        ring_unmap();
+        return false;
+    }
+
+    if (verbose) {
+        LOG("Sampling %u sensors through io_uring", count);
+    }
+
+    return true;
+}
+
+bool sampler_active()
+{
+    return ring.ring_fd != -1;
+}
+
+static void consume(const struct io_uring_cqe *cqe)
+{
+    if (cqe->user_data < ring.entries && cqe->res > 0) {
+        char *buf = ring.bufs[cqe->user_data];
+        buf[cqe->res] = '\0';
+        sscanf(buf, "%u", &ring.sensors[cqe->user_data]->temperature);
+    } else {
+        sampler_stats.read_errors++;
+    }
+}
+
+/* Wait for the reads still in flight, so the kernel is done with the
+ * buffers, then tear the ring down. The caller falls back to pread */
+static void ring_abort(unsigned in_flight)
+{
+    unsigned head = *ring.cq_head;
+
+    for (int stalls = 0; in_flight > 0 && stalls < SAMPLER_MAX_STALLS; ) {
+        if (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+            head++;
+            in_flight--;
+            continue;
+        }
+
+        if (syscall(__NR_io_uring_enter, ring.ring_fd, 0, in_flight, IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+            stalls++;
+        }
+    }
+
+    if (in_flight > 0) {
+        // never hand back buffers the kernel may still write to
+        ring.bufs = NULL;
+    }
+
+    LOG("io_uring sensor reads failed, falling back to pread");
+    ring_unmap();
+}
+
+bool sampler_refresh()
+{
+    unsigned tail = *ring.sq_tail;
+    unsigned mask = *ring.sq_mask;
+    unsigned i;
+
+    for (i = 0; i < ring.entries; i++) {
+        unsigned index = tail & mask;
+        struct io_uring_sqe *sqe = &ring.sqes[index];
+
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->fd = i;
+        sqe->addr = (unsigned long)ring.bufs[i];
+        sqe->len = SAMPLE_BUF_SIZE - 1;
+        sqe->off = 0;
+        sqe->user_data = i;
+
+        ring.sq_array[index] = index;
+        tail++;
+    }
+
+    __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+    unsigned head = *ring.cq_head;
+    unsigned submitted = 0;
+    unsigned completed = 0;
+    int stalls = 0;
+
+    while (completed < ring.entries) {
+        while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+            consume(&ring.cqes[head & *ring.cq_mask]);
+            head++;
+            completed++;
+        }
+
+        if (completed == ring.entries) {
+            break;
+        }
+
+        // a short submission returns without waiting, submit the rest first
+        const int res = syscall(__NR_io_uring_enter, ring.ring_fd, ring.entries - submitted,
+                                ring.entries - completed, IORING_ENTER_GETEVENTS, NULL, 0);
+        sampler_stats.syscalls++;
+
+        if (res > 0) {
+            submitted += res;
+            stalls = 0;
+
+        } else if ((res == 0 || errno == EINTR || errno == EAGAIN || errno == EBUSY) &&
+                   ++stalls < SAMPLER_MAX_STALLS) {
+            continue;
+
+        } else {
+            __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+            ring_abort(submitted - completed);
+            return false;
+        }
+    }
+
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+    sampler_stats.sensors = ring.entries;
+
+    return true;
+}
+
+void sampler_close()
+{
+    ring_unmap();
+}
+
+#else
+
+bool sampler_init(t_sensors *sensors)
+{
+    (void)sensors;
+    return false;
+}
+
+bool sampler_active()
+{
+    return false;
+}
+
+bool sampler_refresh()
+{
+    return false;
+}
+
+void sampler_close()
+{
+}
+
+#endif
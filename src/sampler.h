@@ -0,0 +1,62 @@
+/**
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _SAMPLER_H_
+#define _SAMPLER_H_
+
+#include <stdbool.h>
+
+struct s_sensors;
+typedef struct s_sensors t_sensors;
+
+/** Cost of one pass over the sensors in the last refresh
+ *  syscalls - number of syscalls issued to read all the sensors once
+ *  nsec - wall time spent reading and parsing the sensors once
+ *  passes - reads of each sensor in the refresh, filter_oversample
+ *  read_errors - failed sensor reads since startup, never reset
+ */
+typedef struct {
+    int sensors;
+    int syscalls;
+    long nsec;
+    int passes;
+    unsigned long read_errors;
+} t_sampler_stats;
+
+extern t_sampler_stats sampler_stats;
+
+/**
+ * Register the file descriptors of the given sensors with an io_uring
+ * instance so that each refresh is a single submission.
+ * Return true on success, false if io_uring is not available
+ * (the caller keeps using pread)
+ */
+bool sampler_init(t_sensors *sensors);
+
+/**
+ * Return true if the io_uring backend is in use
+ */
+bool sampler_active();
+
+/**
+ * Read every registered sensor with a single io_uring_enter() call
+ * Return false if the batch failed and the caller should fall back to pread
+ */
+bool sampler_refresh();
+
+/**
+ * Tear down the io_uring instance, the sensor files are not closed
+ */
+void sampler_close();
+
+#endif
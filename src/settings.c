@@ -332,6 +332,24 @@ int settings_section_get_count(const Settings *settings, const char *section)
     return sm_get_count(sect->map);
 }
 
+unsigned int settings_get_section_count(const Settings *settings)
+{
+    if (settings == NULL) {
+        return 0;
+    }
+
+    return settings->section_count;
+}
+
+const char * settings_get_section_name(const Settings *settings, unsigned int n)
+{
+    if (settings == NULL || n >= settings->section_count) {
+        return NULL;
+    }
+
+    return settings->sections[n].name;
+}
+
 int settings_section_enum(const Settings *settings, const char *section, settings_section_enum_func enum_func, const void *obj)
 {
     Section *sect;
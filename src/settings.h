@@ -313,6 +313,32 @@ int settings_set(Settings *setting, const char *section, const char *key, const
  */
 int settings_section_get_count(const Settings *settings, const char *section);
 
+/*
+ * Returns the number of sections.
+ *
+ * Parameters:
+ *
+ * settings: A pointer to a settings object. This parameter cannot be null.
+ *
+ * Return value: The number of sections.
+ */
+unsigned int settings_get_section_count(const Settings *settings);
+
+/*
+ * Returns the name of a section.
+ *
+ * Parameters:
+ *
+ * settings: A pointer to a settings object. This parameter cannot be null.
+ *
+ * n: The index of the section, between 0 and the number of sections
+ * returned by settings_get_section_count.
+ *
+ * Return value: A pointer to a null-terminated C string that must not be
+ * modified by the client, or null if the index is out of range.
+ */
+const char * settings_get_section_name(const Settings *settings, unsigned int n);
+
 /*
  * Enumerates all associations between keys and values in the provided
  * section.
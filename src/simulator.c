@@ -0,0 +1,388 @@
+/**
+ *  simulator.c - thermal plant simulator for accelerated controller runs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  Notes:
+ *    The CPU is an RC network: every core is a small heat capacity tied to
+ *    the package, the package (die, heat spreader and heatsink) is tied to
+ *    the ambient air through a conductance that grows with the fan RPM.
+ *    Fans follow the commanded speed with a first order lag and draw a
+ *    power proportional to the cube of their speed.
+ *    The constants give a MacBook Pro like behaviour: ~50C idle, and
+ *    under full load with the fans at maximum speed the package settles
+ *    at 25 + 45 / 0.65 = ~94C and the cores ~4.5C above, near throttling.
+ *    Sensors report millidegrees like coretemp, not whole degrees.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <syslog.h>
+#include <stdbool.h>
+#include "mbpfan.h"
+#include "global.h"
+#include "simulator.h"
+#include "aggregate.h"
+
+/* lazy min/max... */
+#define min(a,b) ((a) < (b) ? (a) : (b))
+#define max(a,b) ((a) > (b) ? (a) : (b))
+
+#define SIM_STEP 0.05           // s, integration step
+#define SIM_AMBIENT 25.0        // C
+#define SIM_IDLE_POWER 8.0      // W
+#define SIM_MAX_POWER 45.0      // W
+#define SIM_UNCORE_SHARE 0.2    // part of the power dissipated outside the cores
+#define SIM_CORE_CAPACITY 2.0   // J/K
+#define SIM_CORE_RESISTANCE 0.5 // K/W, core to package
+#define SIM_PKG_CAPACITY 40.0   // J/K
+#define SIM_PASSIVE_CONDUCTANCE 0.2 // W/K, package to ambient without airflow
+#define SIM_FAN_CONDUCTANCE 0.45    // W/K, added by all fans at maximum speed
+#define SIM_FAN_LAG 2.0         // s
+#define SIM_FAN_POWER 3.0       // W, per fan at maximum speed
+#define SIM_FANS 2
+#define SIM_CORES 4
+
+static const t_sim_load profile_step[] = {
+    { 0, 0.05 }, { 120, 1.0 }, { 720, 0.05 }, { 1320, 0.05 }
+};
+
+static const t_sim_load profile_burst[] = {
+    { 0, 0.05 }, { 60, 1.0 }, { 90, 0.05 }, { 180, 1.0 }, { 195, 0.05 },
+    { 300, 0.8 }, { 420, 0.05 }, { 480, 1.0 }, { 500, 0.05 }, { 900, 0.05 }
+};
+
+int sim_load_profile(const char *name, t_sim_load **points)
+{
+    const t_sim_load *builtin = NULL;
+    int count = 0;
+
+    if (strcmp(name, "step") == 0) {
+        builtin = profile_step;
+        count = sizeof(profile_step) / sizeof(profile_step[0]);
+
+    } else if (strcmp(name, "burst") == 0) {
+        builtin = profile_burst;
+        count = sizeof(profile_burst) / sizeof(profile_burst[0]);
+    }
+
+    if (builtin != NULL) {
+        *points = malloc(count * sizeof(t_sim_load));
+        memcpy(*points, builtin, count * sizeof(t_sim_load));
+        return count;
+    }
+
+    FILE *file = fopen(name, "r");
+
+    if (file == NULL) {
+        return 0;
+    }
+
+    int size = 16;
+    char line[128];
+    *points = malloc(size * sizeof(t_sim_load));
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        t_sim_load point;
+
+        if (line[0] == '#' || sscanf(line, "%lf,%lf", &point.time, &point.load) != 2) {
+            continue;
+        }
+
+        if (count == size) {
+            size *= 2;
+            *points = realloc(*points, size * sizeof(t_sim_load));
+        }
+
+        point.load = min(max(point.load, 0), 1);
+        (*points)[count++] = point;
+    }
+
+    fclose(file);
+
+    if (count == 0) {
+        free(*points);
+        *points = NULL;
+    }
+
+    return count;
+}
+
+static double load_at(const t_sim_load *profile, int count, double time)
+{
+    double load = profile[0].load;
+
+    for (int i = 0; i < count && profile[i].time <= time; i++) {
+        load = profile[i].load;
+    }
+
+    return load;
+}
+
+t_fans *sim_fans(int count)
+{
+    t_fans *head = NULL;
+    t_fans **next = &head;
+
+    for (int i = 0; i < count; i++) {
+        t_fans *fan = malloc(sizeof(t_fans));
+        memset(fan, 0, sizeof(t_fans));
+
+        fan->name = smprintf("sim%d", i + 1);
+        fan->fan_id = i + 1;
+        fan->manual_fd = -1;
+        fan->speed_ratio = fan_ratios[i] > 0 ? fan_ratios[i] : 1.0;
+        fan->min_speed = fan_min_speeds[i] > 0 ? fan_min_speeds[i] : min_fan_speed;
+        fan->max_speed = fan_max_speeds[i] > 0 ? fan_max_speeds[i] : max_fan_speed;
+
+        *next = fan;
+        next = &fan->next;
+    }
+
+    return head;
+}
+
+static t_sensors *sim_sensors(int count)
+{
+    t_sensors *head = NULL;
+    t_sensors **next = &head;
+
+    for (int i = 0; i < count; i++) {
+        t_sensors *sensor = malloc(sizeof(t_sensors));
+        memset(sensor, 0, sizeof(t_sensors));
+
+        sensor->path = smprintf("sim/temp%d_input", i + 1);
+        sensor->label = i == 0 ? strdup("Package id 0") : smprintf("Core %d", i - 1);
+        sensor->driver = strdup("coretemp");
+        sensor->weight = sensor_weight(sensor->label);
+        sensor->alarm_fd = -1;
+
+        *next = sensor;
+        next = &sensor->next;
+    }
+
+    return head;
+}
+
+void free_sim_fans(t_fans *fans)
+{
+    while (fans != NULL) {
+        t_fans *next = fans->next;
+        free(fans->name);
+        free(fans);
+        fans = next;
+    }
+}
+
+static void free_sim_sensors(t_sensors *sensors)
+{
+    while (sensors != NULL) {
+        t_sensors *next = sensors->next;
+        free(sensors->path);
+        free(sensors->label);
+        free(sensors->driver);
+        free(sensors);
+        sensors = next;
+    }
+}
+
+void simulate(const t_sim_load *profile, int count, int cores, t_sim_result *result)
+{
+    memset(result, 0, sizeof(*result));
+    result->duration = profile[count - 1].time;
+
+    t_sensors *sim_sensor_list = sim_sensors(cores + 1);
+    t_fans *sim_fan_list = sim_fans(SIM_FANS);
+
+    // start from the idle steady state with the fans at minimum speed
+    const double idle_airflow = pow((double)min_fan_speed / max_fan_speed, 0.8);
+    double pkg_temp = SIM_AMBIENT + SIM_IDLE_POWER / (SIM_PASSIVE_CONDUCTANCE + SIM_FAN_CONDUCTANCE * idle_airflow);
+    double core_temps[cores];
+    double fan_rpm[SIM_FANS];
+
+    for (int i = 0; i < cores; i++) {
+        core_temps[i] = pkg_temp;
+    }
+
+    for (int i = 0; i < SIM_FANS; i++) {
+        fan_rpm[i] = min_fan_speed;
+    }
+
+    int samples_size = 1024;
+    double *samples = malloc(samples_size * sizeof(double));
+    double *sample_times = malloc(samples_size * sizeof(double));
+
+    t_state_classic state_classic;
+    t_state_pid state_pid;
+    t_state_polling state_polling;
+    t_history history;
+    t_kalman kalman;
+
+    double time = 0;
+    double next_tick = 0;
+    double last_tick = 0;
+    double last_change = 0;
+    bool first_tick = true;
+
+    for (int i = 1; i < count; i++) {
+        if (profile[i].load != profile[i - 1].load) {
+            last_change = profile[i].time;
+        }
+    }
+
+    while (time < result->duration) {
+        if (time >= next_tick) {
+            t_sensors *sensor = sim_sensor_list;
+            sensor->temperature = (int)lround(pkg_temp * 1000);
+
+            for (int i = 0; i < cores; i++) {
+                sensor = sensor->next;
+                sensor->temperature = (int)lround(core_temps[i] * 1000);
+            }
+
+            // sensors have no file, get_temp() only averages them
+            const float temp = get_temp(sim_sensor_list);
+            float filtered = temp;
+
+            if (first_tick) {
+                if (pid_values) {
+                    fan_speed_pid_init(&state_pid, NULL);
+                } else {
+                    fan_speed_classic_init(&state_classic, temp, NULL);
+                }
+                polling_init(&state_polling, temp);
+                history_init(&history, temp_window);
+                kalman_init(&kalman);
+                state_pid.history = &history;
+                state_pid.kalman = kalman_enabled() ? &kalman : NULL;
+                state_classic.history = &history;
+                state_polling.history = &history;
+                first_tick = false;
+
+            } else {
+                state_polling.interval_ms = (time - last_tick) * 1000;
+                state_pid.interval = time - last_tick;
+            }
+
+            if (kalman_enabled()) {
+                filtered = kalman_update(&kalman, time, temp);
+            }
+
+            history_push(&history, time, filtered);
+
+            const int fan_speed = pid_values
+                ? fan_speed_pid(filtered, &state_pid)
+                : fan_speed_classic(filtered, &state_classic);
+
+            const unsigned long writes = sim_fan_list->writes;
+            const unsigned long suppressed = sim_fan_list->suppressed;
+            set_fan_speed_at(sim_fan_list, fan_speed, filtered > high_temp, time * 1000);
+            result->fan_changes += sim_fan_list->writes - writes;
+            result->fan_suppressed += sim_fan_list->suppressed - suppressed;
+
+            if (result->ticks == samples_size) {
+                samples_size *= 2;
+                samples = realloc(samples, samples_size * sizeof(double));
+                sample_times = realloc(sample_times, samples_size * sizeof(double));
+            }
+
+            samples[result->ticks] = temp;
+            sample_times[result->ticks] = time;
+            result->ticks++;
+
+            last_tick = time;
+            next_tick = time + polling_next_interval(filtered, &state_polling) / 1000.0;
+        }
+
+        // Heat flow
+        const double power = SIM_IDLE_POWER + load_at(profile, count, time) * (SIM_MAX_POWER - SIM_IDLE_POWER);
+        const double core_power = power * (1 - SIM_UNCORE_SHARE) / cores;
+        double to_pkg = power * SIM_UNCORE_SHARE;
+
+        for (int i = 0; i < cores; i++) {
+            const double flow = (core_temps[i] - pkg_temp) / SIM_CORE_RESISTANCE;
+            core_temps[i] += (core_power - flow) * SIM_STEP / SIM_CORE_CAPACITY;
+            to_pkg += flow;
+        }
+
+        double airflow = 0;
+        int fan_index = 0;
+
+        for (t_fans *fan = sim_fan_list; fan != NULL && fan_index < SIM_FANS; fan = fan->next, fan_index++) {
+            fan_rpm[fan_index] += (fan->old_speed - fan_rpm[fan_index]) * SIM_STEP / SIM_FAN_LAG;
+
+            const double ratio = max(fan_rpm[fan_index], 0) / fan->max_speed;
+            airflow += pow(ratio, 0.8) / SIM_FANS;
+            result->fan_energy += SIM_FAN_POWER * ratio * ratio * ratio * SIM_STEP;
+        }
+
+        const double conductance = SIM_PASSIVE_CONDUCTANCE + SIM_FAN_CONDUCTANCE * airflow;
+        pkg_temp += (to_pkg - (pkg_temp - SIM_AMBIENT) * conductance) * SIM_STEP / SIM_PKG_CAPACITY;
+
+        time += SIM_STEP;
+    }
+
+    // Metrics over the controller samples
+    result->final_temp = result->ticks > 0 ? samples[result->ticks - 1] : 0;
+
+    for (int i = 0; i < result->ticks; i++) {
+        const double span = (i + 1 < result->ticks ? sample_times[i + 1] : result->duration) - sample_times[i];
+
+        result->peak_temp = max(result->peak_temp, samples[i]);
+
+        if (samples[i] > max_temp) {
+            result->time_above_max += span;
+        }
+
+        if (sample_times[i] >= last_change && fabs(samples[i] - result->final_temp) > 1) {
+            result->settle_time = sample_times[i] + span - last_change;
+        }
+    }
+
+    result->overshoot = max(result->peak_temp - high_temp, 0);
+
+    free(samples);
+    free(sample_times);
+    free_sim_fans(sim_fan_list);
+    free_sim_sensors(sim_sensor_list);
+}
+
+int simulation(const char *profile_name)
+{
+    t_sim_load *profile = NULL;
+    int count = sim_load_profile(profile_name, &profile);
+
+    if (count == 0) {
+        printf("Could not read load profile '%s'\n", profile_name);
+        return 1;
+    }
+
+    retrieve_settings(settings_path);
+
+    t_sim_result result;
+    simulate(profile, count, SIM_CORES, &result);
+    free(profile);
+
+    printf("Controller:      %s\n", pid_values ? "PID" : "classic");
+    printf("Virtual time:    %.0f s (%d ticks)\n", result.duration, result.ticks);
+    printf("Peak:            %.1f C\n", result.peak_temp);
+    printf("Final:           %.1f C\n", result.final_temp);
+    printf("Overshoot:       %.1f C above high_temp\n", result.overshoot);
+    printf("Settle time:     %.1f s\n", result.settle_time);
+    printf("Above max_temp:  %.1f s\n", result.time_above_max);
+    printf("Fan energy:      %.1f J\n", result.fan_energy);
+    printf("Fan changes:     %d (%d suppressed)\n", result.fan_changes, result.fan_suppressed);
+
+    return 0;
+}
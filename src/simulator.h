@@ -0,0 +1,78 @@
+/**
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _SIMULATOR_H_
+#define _SIMULATOR_H_
+
+#include <stdbool.h>
+#include "mbpfan.h"
+
+/** A point of a load profile, the load holds until the next point
+ *  time - seconds of virtual time
+ *  load - fraction of the CPU power, 0 (idle) to 1 (full load)
+ */
+typedef struct {
+    double time;
+    double load;
+} t_sim_load;
+
+/** Outcome of a simulated run
+ *  settle_time - seconds after the last load change until the temperature
+ *                stays within 1C of its final value
+ *  fan_energy - Joules spent by the fans
+ *  fan_changes, fan_suppressed - speed writes of the first fan, issued
+ *                                and held back by fan_deadband/fan_dwell
+ */
+typedef struct {
+    double duration;
+    double peak_temp;
+    double final_temp;
+    double overshoot;
+    double settle_time;
+    double time_above_max;
+    double fan_energy;
+    int fan_changes;
+    int fan_suppressed;
+    int ticks;
+} t_sim_result;
+
+/**
+ * Read a load profile from a file with one "time,load" pair per line,
+ * or return a built-in profile: "step" (idle, 10 minutes of full load,
+ * idle) or "burst" (short full load bursts).
+ * Return the number of points, 0 on failure. The caller frees *points
+ */
+int sim_load_profile(const char *name, t_sim_load **points);
+
+/**
+ * Run the controller selected by the current settings against a thermal
+ * model of a CPU with the given number of cores, in virtual time.
+ * The model is driven through sensors and fans lists like the daemon.
+ */
+void simulate(const t_sim_load *profile, int count, int cores, t_sim_result *result);
+
+/**
+ * Return a list of count fans without files, set from the current
+ * settings, for runs without sysfs. Free it with free_sim_fans()
+ */
+t_fans *sim_fans(int count);
+
+void free_sim_fans(t_fans *fans);
+
+/**
+ * Load the profile, run the simulation and print the metrics
+ * Return 0 on success
+ */
+int simulation(const char *profile_name);
+
+#endif
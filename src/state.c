@@ -0,0 +1,281 @@
+/**
+ *  state.c - controller state kept across restarts for a warm start
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  Notes:
+ *    The file is a fixed size record with a CRC32, written to a temporary
+ *    file and renamed so a crash never leaves half a state behind. It is
+ *    stamped with both CLOCK_REALTIME and CLOCK_BOOTTIME: a state is only
+ *    resumed if both clocks moved alike since, which rejects a file kept
+ *    from a previous boot even if /run is not a tmpfs.
+ *    The history of a resumed zone is seeded with two samples on the saved
+ *    slope, so the classic controller and the D term see the trend at once.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include "global.h"
+#include "mbpfan.h"
+#include "zones.h"
+#include "state.h"
+
+// Largest difference between the realtime and boottime clocks in seconds
+// since the save, NTP adjustments included, for a state of this boot
+#define STATE_CLOCK_DRIFT 30
+
+char state_path[108] = "/run/mbpfan.state";
+int state_max_age = 60;
+
+typedef struct {
+    char name[32];
+    int32_t pid;
+    float temp;
+    float slope;
+    int32_t speed;
+    float integral;
+    float error_prior;
+    int32_t last_speed;
+    int32_t classic_speed;
+    int32_t old_temp;
+} t_state_zone;
+
+/** Layout of the state file
+ *  checksum - CRC32 of the file with this field set to 0
+ *  realtime_ms, boottime_ms - when it was saved
+ *  speeds - base speed of each fan of the list
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t checksum;
+    int64_t realtime_ms;
+    int64_t boottime_ms;
+    int32_t zone_count;
+    int32_t fan_count;
+    int32_t speeds[MAX_FANS];
+    t_state_zone zones[MAX_ZONES];
+} t_state_file;
+
+static struct {
+    const char *path;
+    const t_zone *zones;
+    const int *zone_count;
+    int speeds[MAX_FANS];
+    bool updated;
+    double last_save;
+} saver = { .path = NULL };
+
+// copy of the path given to state_start(), a reload rewrites state_path
+static char saver_path[sizeof(state_path)];
+
+static int64_t clock_ms(clockid_t clock)
+{
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static int count_fans()
+{
+    int count = 0;
+
+    for (t_fans *fan = fans; fan != NULL && count < MAX_FANS; fan = fan->next) {
+        count++;
+    }
+
+    return count;
+}
+
+bool state_save(const char *path, const t_zone *zones, int count, const int *speeds)
+{
+    t_state_file state;
+    memset(&state, 0, sizeof(state));
+
+    state.magic = STATE_MAGIC;
+    state.version = STATE_VERSION;
+    state.size = sizeof(state);
+    state.realtime_ms = clock_ms(CLOCK_REALTIME);
+    state.boottime_ms = clock_ms(CLOCK_BOOTTIME);
+    state.zone_count = count;
+    state.fan_count = count_fans();
+    memcpy(state.speeds, speeds, sizeof(state.speeds));
+
+    for (int i = 0; i < count; i++) {
+        const t_zone *zone = &zones[i];
+        t_state_zone *saved = &state.zones[i];
+
+        snprintf(saved->name, sizeof(saved->name), "%s", zone->config.name);
+        saved->pid = zone->config.pid;
+        saved->temp = zone->temp;
+        saved->slope = history_slope(&zone->history);
+        saved->speed = zone->speed;
+        saved->integral = zone->pid.integral;
+        saved->error_prior = zone->pid.error_prior;
+        saved->last_speed = zone->pid.last_speed;
+        saved->classic_speed = zone->classic.fan_speed;
+        saved->old_temp = zone->classic.old_temp;
+    }
+
+    state.checksum = crc32(&state, sizeof(state));
+
+    char *temporary = smprintf("%s.tmp", path);
+    const int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool written = fd != -1 && write(fd, &state, sizeof(state)) == sizeof(state);
+
+    if (fd != -1) {
+        written = close(fd) == 0 && written;
+    }
+
+    written = written && rename(temporary, path) == 0;
+
+    if (!written) {
+        const int saved = errno;
+        unlink(temporary);
+        errno = saved;
+    }
+
+    free(temporary);
+    return written;
+}
+
+bool state_restore(const char *path, t_zone *zones, int count, double now, int *speeds,
+                   char *error, size_t size)
+{
+    t_state_file state;
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1) {
+        snprintf(error, size, "No saved state in %s", path);
+        return false;
+    }
+
+    const bool complete = read(fd, &state, sizeof(state)) == sizeof(state);
+    close(fd);
+
+    if (!complete || state.magic != STATE_MAGIC || state.version != STATE_VERSION ||
+        state.size != sizeof(state)) {
+        snprintf(error, size, "Saved state %s is not valid", path);
+        return false;
+    }
+
+    const uint32_t checksum = state.checksum;
+    state.checksum = 0;
+
+    if (crc32(&state, sizeof(state)) != checksum) {
+        snprintf(error, size, "Saved state %s is corrupted", path);
+        return false;
+    }
+
+    const int64_t boot_age = clock_ms(CLOCK_BOOTTIME) - state.boottime_ms;
+    const int64_t real_age = clock_ms(CLOCK_REALTIME) - state.realtime_ms;
+
+    if (boot_age < 0 || llabs(real_age - boot_age) > STATE_CLOCK_DRIFT * 1000) {
+        snprintf(error, size, "Saved state %s is from a previous boot", path);
+        return false;
+    }
+
+    if (boot_age > state_max_age * 1000LL) {
+        snprintf(error, size, "Saved state %s is %lld s old", path, (long long)(boot_age / 1000));
+        return false;
+    }
+
+    if (state.zone_count != count || state.fan_count != count_fans()) {
+        snprintf(error, size, "Saved state %s has other zones or fans", path);
+        return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (strcmp(state.zones[i].name, zones[i].config.name) != 0 ||
+            state.zones[i].pid != zones[i].config.pid) {
+            snprintf(error, size, "Saved state %s has another zone %s", path, state.zones[i].name);
+            return false;
+        }
+    }
+
+    const double interval = polling_interval;
+
+    for (int i = 0; i < count; i++) {
+        t_zone *zone = &zones[i];
+        const t_state_zone *saved = &state.zones[i];
+
+        zone->temp = saved->temp;
+        zone->speed = saved->speed;
+        zone->pid.integral = saved->integral;
+        zone->pid.error_prior = saved->error_prior;
+        zone->pid.last_speed = saved->last_speed;
+        zone->classic.fan_speed = saved->classic_speed;
+        zone->classic.old_temp = saved->old_temp;
+
+        history_push(&zone->history, now - 2 * interval, saved->temp - 2 * interval * saved->slope);
+        history_push(&zone->history, now - interval, saved->temp - interval * saved->slope);
+    }
+
+    for (int i = 0; i < MAX_FANS; i++) {
+        speeds[i] = state.speeds[i];
+    }
+
+    return true;
+}
+
+void state_start(const char *path, const t_zone *zones, const int *zone_count)
+{
+    snprintf(saver_path, sizeof(saver_path), "%s", path);
+    saver.path = saver_path;
+    saver.zones = zones;
+    saver.zone_count = zone_count;
+    saver.updated = false;
+    saver.last_save = 0;
+    memset(saver.speeds, 0, sizeof(saver.speeds));
+}
+
+void state_update(const int *speeds, double now)
+{
+    if (saver.path == NULL) {
+        return;
+    }
+
+    memcpy(saver.speeds, speeds, sizeof(saver.speeds));
+    saver.updated = true;
+
+    if (now - saver.last_save < STATE_SAVE_INTERVAL) {
+        return;
+    }
+
+    saver.last_save = now;
+
+    if (!state_save(saver.path, saver.zones, *saver.zone_count, saver.speeds) && verbose) {
+        LOG("Could not save the state to %s: %s", saver.path, strerror(errno));
+    }
+}
+
+void state_stop()
+{
+    if (saver.path == NULL) {
+        return;
+    }
+
+    if (saver.updated && !state_save(saver.path, saver.zones, *saver.zone_count, saver.speeds)) {
+        LOG("Could not save the state to %s: %s", saver.path, strerror(errno));
+    }
+
+    saver.path = NULL;
+}
@@ -0,0 +1,67 @@
+/**
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _STATE_H_
+#define _STATE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "zones.h"
+
+#define STATE_MAGIC 0x6d627073  // "mbps"
+#define STATE_VERSION 1
+// Seconds between two saves of the state while running
+#define STATE_SAVE_INTERVAL 10
+
+/** File holding the controller state across restarts, empty to disable
+ *  Default is /run/mbpfan.state
+ */
+extern char state_path[108];
+
+/** Oldest state in seconds resumed at startup, default 60 */
+extern int state_max_age;
+
+/**
+ * Write the state of the zones and the base speed of each fan to path,
+ * replacing it atomically. Return false if it could not be written
+ */
+bool state_save(const char *path, const t_zone *zones, int count, const int *speeds);
+
+/**
+ * Resume the controllers of the zones from the state saved at path, if it
+ * is valid, was saved by this boot less than state_max_age seconds ago and
+ * matches the zones. now is the monotonic time in seconds, speeds receives
+ * the base speed of each fan. Return false with the reason in error if the
+ * zones must start cold
+ */
+bool state_restore(const char *path, t_zone *zones, int count, double now, int *speeds,
+                   char *error, size_t size);
+
+/**
+ * Save the state of the zones of the control loop to path every
+ * STATE_SAVE_INTERVAL seconds, see state_update(), and on state_stop()
+ */
+void state_start(const char *path, const t_zone *zones, const int *zone_count);
+
+/**
+ * Record the base speeds of the last tick, save them with the zones when
+ * the last save is older than STATE_SAVE_INTERVAL. now is monotonic seconds
+ */
+void state_update(const int *speeds, double now);
+
+/**
+ * Save the state a last time
+ */
+void state_stop();
+
+#endif
@@ -0,0 +1,97 @@
+/**
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "mbpfan.h"
+
+#define TELEMETRY_MAGIC 0x6d627066  // "mbpf"
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_HISTORY 64
+
+/** Name of the shared memory segment (/dev/shm/<name>), empty to disable
+ *  Default is /mbpfan
+ */
+extern char telemetry_shm[64];
+
+/** One tick of the control loop
+ *  time_ns - CLOCK_MONOTONIC when the sensors were read
+ *  temp - temperature driving the loop (the hottest zone)
+ *  fan_speed - base speed asked by the zones
+ */
+typedef struct {
+    uint64_t time_ns;
+    float temp;
+    int32_t fan_speed;
+} t_telemetry_point;
+
+/** Layout of the shared memory segment, fixed size fields only
+ *  sequence - seqlock, odd while the daemon updates the segment: copy the
+ *             segment between two reads of an equal, even sequence
+ *  ticks - number of ticks published so far
+ *  sensor_temp - millidegrees of each sensor, after oversampling
+ *  fan_target - RPM last written to each fan
+ *  read_ns, compute_ns, write_ns - duration of the phases of the last tick
+ *  history - last ticks, history[(ticks - 1) % TELEMETRY_HISTORY] is the latest
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t pid;
+    uint64_t sequence;
+    uint64_t ticks;
+    t_telemetry_point last;
+    int32_t sensor_count;
+    int32_t fan_count;
+    int32_t sensor_temp[MAX_SENSORS];
+    int32_t fan_target[MAX_FANS];
+    uint64_t read_ns;
+    uint64_t compute_ns;
+    uint64_t write_ns;
+    t_telemetry_point history[TELEMETRY_HISTORY];
+} t_telemetry;
+
+/**
+ * Create the shared memory segment /dev/shm/<name> and map it
+ * Return false if it could not be created
+ */
+bool telemetry_open(const char *name);
+
+/**
+ * Publish a tick: the given values, sensor_samples and the fans list.
+ * Does nothing unless telemetry_open() succeeded
+ */
+void telemetry_publish(uint64_t time_ns, float temp, int fan_speed,
+                       uint64_t read_ns, uint64_t compute_ns, uint64_t write_ns);
+
+/**
+ * Copy a consistent snapshot of a mapped segment, retrying while the
+ * daemon writes it. Return false if the segment is not a valid one
+ */
+bool telemetry_read(const volatile t_telemetry *shared, t_telemetry *copy);
+
+/**
+ * Return the segment mapped by telemetry_open(), NULL if none
+ */
+const t_telemetry *telemetry_segment();
+
+/**
+ * Unmap and remove the segment
+ */
+void telemetry_close();
+
+#endif
@@ -0,0 +1,446 @@
+/**
+ *  zones.c - groups of sensors driving groups of fans
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  Notes:
+ *    Every zone averages its own sensors and runs its own controller.
+ *    A fan served by several zones follows the one asking for the highest
+ *    speed, so a hot GPU is not held back by a cool CPU on a shared fan.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <stdbool.h>
+#include "global.h"
+#include "mbpfan.h"
+#include "zones.h"
+
+#define max(a,b) ((a) > (b) ? (a) : (b))
+
+#define ZONE_PREFIX "zone."
+
+t_zone_config zone_configs[MAX_ZONES];
+int zone_count = 0;
+
+// Return true if name is an item of the comma-delimited list, labels may hold spaces
+static bool list_contains(const char* list, const char* name)
+{
+    const size_t len = strlen(name);
+    const char* item = list;
+
+    while (item != NULL && *item != '\0') {
+        while (*item == ' ') {
+            item++;
+        }
+
+        if (strncmp(item, name, len) == 0) {
+            const char* end = item + len;
+
+            while (*end == ' ') {
+                end++;
+            }
+
+            if (*end == '\0' || *end == ',') {
+                return true;
+            }
+        }
+
+        item = strchr(item, ',');
+
+        if (item != NULL) {
+            item++;
+        }
+    }
+
+    return false;
+}
+
+static bool read_zone(const Settings* settings, const char* section, const t_zone_config* defaults,
+                      t_zone_config* zone, char* error, size_t size)
+{
+    *zone = *defaults;
+    snprintf(zone->name, sizeof(zone->name), "%s", section + strlen(ZONE_PREFIX));
+
+    settings_get(settings, section, "sensors", zone->sensors, sizeof(zone->sensors));
+    settings_get(settings, section, "fans", zone->fans, sizeof(zone->fans));
+
+    t_thresholds* t = &zone->thresholds;
+    int result;
+
+    result = settings_get_int(settings, section, "low_temp");
+    if (result != 0) t->low_temp = result;
+
+    result = settings_get_int(settings, section, "high_temp");
+    if (result != 0) t->high_temp = result;
+
+    result = settings_get_int(settings, section, "max_temp");
+    if (result != 0) t->max_temp = result;
+
+    result = settings_get_int(settings, section, "min_fan_speed");
+    if (result != 0) t->min_fan_speed = result;
+
+    result = settings_get_int(settings, section, "max_fan_speed");
+    if (result != 0) t->max_fan_speed = result;
+
+    int pid_values_temp[10];
+    unsigned int readCount = 0;
+    result = settings_get_int_tuple(settings, section, "pid_values", pid_values_temp, 10, &readCount);
+
+    if (result != 0) {
+        if (readCount != 3) {
+            snprintf(error, size, "Zone %s: wrong number of PID constants, 3 expected.", zone->name);
+            return false;
+        }
+        for (int i = 0; i < 3; i++) t->pid_values[i] = pid_values_temp[i];
+        zone->pid = true;
+    }
+
+    char temp_aggregate[16];
+    result = settings_get(settings, section, "temp_aggregate", temp_aggregate, sizeof(temp_aggregate));
+
+    if (result != 0) {
+        zone->aggregation.mode = aggregation_mode(temp_aggregate);
+
+        if (zone->aggregation.mode == -1) {
+            snprintf(error, size, "Zone %s: unknown temp_aggregate '%s'", zone->name, temp_aggregate);
+            return false;
+        }
+    }
+
+    result = settings_get_int(settings, section, "temp_topk");
+    if (result != 0) zone->aggregation.topk = result;
+
+    char controller[16];
+    result = settings_get(settings, section, "controller", controller, sizeof(controller));
+
+    if (result != 0) {
+        if (strcmp(controller, "pid") == 0) {
+            zone->pid = true;
+        } else if (strcmp(controller, "classic") == 0) {
+            zone->pid = false;
+        } else {
+            snprintf(error, size, "Zone %s: unknown controller '%s'", zone->name, controller);
+            return false;
+        }
+    }
+
+    // Sanity checks
+    if (zone->pid && !defaults->pid && readCount == 0) {
+        snprintf(error, size, "Zone %s: the PID controller needs pid_values", zone->name);
+        return false;
+    }
+    if (zone->aggregation.topk < 1) {
+        snprintf(error, size, "Zone %s: invalid temp_topk %d", zone->name, zone->aggregation.topk);
+        return false;
+    }
+    if (t->min_fan_speed > t->max_fan_speed) {
+        snprintf(error, size, "Zone %s: invalid fan speeds: min_fan_speed %d, max_fan_speed %d",
+                 zone->name, t->min_fan_speed, t->max_fan_speed);
+        return false;
+    }
+    if (t->low_temp >= t->high_temp || t->high_temp >= t->max_temp) {
+        snprintf(error, size, "Zone %s: invalid temperatures: low_temp %d, high_temp %d, max_temp %d",
+                 zone->name, t->low_temp, t->high_temp, t->max_temp);
+        return false;
+    }
+
+    return true;
+}
+
+int zones_read_settings(const Settings* settings, const t_zone_config* defaults,
+                        t_zone_config* configs, char* error, size_t size)
+{
+    int count = 0;
+
+    for (unsigned int i = 0; i < settings_get_section_count(settings); i++) {
+        const char* section = settings_get_section_name(settings, i);
+
+        if (strncmp(section, ZONE_PREFIX, strlen(ZONE_PREFIX)) != 0) {
+            continue;
+        }
+
+        if (count == MAX_ZONES) {
+            snprintf(error, size, "Too many zones, at most %d are supported", MAX_ZONES);
+            return -1;
+        }
+
+        if (!read_zone(settings, section, defaults, &configs[count], error, size)) {
+            return -1;
+        }
+        count++;
+    }
+
+    return count;
+}
+
+bool zones_want_driver(const char* driver)
+{
+    for (int i = 0; i < zone_count; i++) {
+        if (list_contains(zone_configs[i].sensors, driver)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static uint64_t zone_sensor_mask(const t_zone_config* config, t_sensors* sensors)
+{
+    uint64_t mask = 0;
+    int index = 0;
+
+    for (t_sensors* sensor = sensors; sensor != NULL; sensor = sensor->next, index++) {
+        if (!*config->sensors ||
+            (sensor->driver != NULL && list_contains(config->sensors, sensor->driver)) ||
+            list_contains(config->sensors, sensor->label)) {
+            mask |= 1ULL << index;
+        }
+    }
+
+    return mask;
+}
+
+static bool check_zone_fans(const t_zone_config* config, t_fans* fans, char* error, size_t size)
+{
+    char* list = strdup(config->fans);
+    char* next = list;
+    char* name;
+    bool found = true;
+
+    while (found && (name = strsep(&next, ",")) != NULL) {
+        t_fans* fan = fans;
+        while (fan != NULL && !list_contains(name, fan->name)) {
+            fan = fan->next;
+        }
+
+        if (fan == NULL) {
+            snprintf(error, size, "Zone %s: unknown fan '%s'", config->name, name);
+            found = false;
+        }
+    }
+
+    free(list);
+    return found;
+}
+
+bool zones_check(const t_zone_config* configs, int count, t_sensors* sensors, t_fans* fans,
+                 char* error, size_t size)
+{
+    for (int i = 0; i < count; i++) {
+        if (zone_sensor_mask(&configs[i], sensors) == 0) {
+            snprintf(error, size, "Zone %s has no sensors, check its sensors setting", configs[i].name);
+            return false;
+        }
+
+        if (*configs[i].fans && !check_zone_fans(&configs[i], fans, error, size)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void start_controller(t_zone* zone)
+{
+    const t_zone_config* config = &zone->config;
+
+    if (config->pid) {
+        const float* pid = config->thresholds.pid_values;
+
+        fan_speed_pid_init(&zone->pid, &config->thresholds);
+        zone->pid.history = &zone->history;
+        zone->pid.kalman = kalman_enabled() ? &zone->kalman : NULL;
+        LOG("PID control initialized. Kp=%.1f Ki=%.1f Kd=%.1f", pid[0], pid[1], pid[2]);
+    } else {
+        fan_speed_classic_init(&zone->classic, zone->temp, &config->thresholds);
+        zone->classic.history = &zone->history;
+        LOG("Classic control initialized.");
+    }
+}
+
+int zones_init(t_zone* zones, t_sensors* sensors, t_fans* fans)
+{
+    int count = zone_count;
+    char error[128];
+
+    if (!zones_check(zone_configs, zone_count, sensors, fans, error, sizeof(error))) {
+        FAIL("%s", error);
+    }
+
+    if (count == 0) {
+        memset(&zones[0], 0, sizeof(zones[0]));
+        strcpy(zones[0].config.name, "default");
+        settings_thresholds(&zones[0].config.thresholds);
+        zones[0].config.aggregation = temp_aggregation;
+        zones[0].config.pid = pid_values != NULL;
+        count = 1;
+
+    } else {
+        for (int i = 0; i < count; i++) {
+            memset(&zones[i], 0, sizeof(zones[i]));
+            zones[i].config = zone_configs[i];
+        }
+    }
+
+    unsigned int served = 0;
+
+    for (int i = 0; i < count; i++) {
+        t_zone* zone = &zones[i];
+        const t_zone_config* config = &zone->config;
+        int index = 0;
+
+        zone->sensor_mask = zone_sensor_mask(config, sensors);
+
+        if (zone->sensor_mask == 0) {
+            FAIL("Zone %s has no sensors, check its sensors setting", config->name);
+        }
+
+        for (t_fans* fan = fans; fan != NULL && index < MAX_FANS; fan = fan->next, index++) {
+            if (!*config->fans || list_contains(config->fans, fan->name)) {
+                zone->fan_mask |= 1U << index;
+            }
+        }
+
+        served |= zone->fan_mask;
+        zone->temp = aggregate_temp(&sensor_samples, zone->sensor_mask, &config->aggregation);
+
+        history_init(&zone->history, temp_window);
+        kalman_init(&zone->kalman);
+        start_controller(zone);
+
+        if (verbose) {
+            LOG("Zone %s: %d sensors, fans 0x%x, %s control",
+                config->name, __builtin_popcountll(zone->sensor_mask), zone->fan_mask,
+                config->pid ? "PID" : "classic");
+        }
+    }
+
+    int index = 0;
+    for (t_fans* fan = fans; fan != NULL && index < MAX_FANS; fan = fan->next, index++) {
+        if (!(served & (1U << index))) {
+            LOG("Fan %s is in no zone, it stays at its minimum speed", fan->name);
+        }
+    }
+
+    return count;
+}
+
+static bool same_config(const t_zone_config* a, const t_zone_config* b)
+{
+    return strcmp(a->name, b->name) == 0 &&
+           strcmp(a->sensors, b->sensors) == 0 &&
+           strcmp(a->fans, b->fans) == 0 &&
+           memcmp(&a->thresholds, &b->thresholds, sizeof(a->thresholds)) == 0 &&
+           memcmp(&a->aggregation, &b->aggregation, sizeof(a->aggregation)) == 0 &&
+           a->pid == b->pid;
+}
+
+int zones_reload(t_zone* zones, int old_count, t_sensors* sensors, t_fans* fans)
+{
+    // a zone holds a few KiB of history, keep them off the stack
+    static t_zone old[MAX_ZONES];
+    memcpy(old, zones, old_count * sizeof(t_zone));
+
+    const int count = zones_init(zones, sensors, fans);
+
+    for (int i = 0; i < count; i++) {
+        t_zone* zone = &zones[i];
+
+        for (int j = 0; j < old_count; j++) {
+            if (!same_config(&zone->config, &old[j].config) ||
+                old[j].history.window != zone->history.window) {
+                continue;
+            }
+
+            zone->classic = old[j].classic;
+            zone->pid = old[j].pid;
+            zone->temp = old[j].temp;
+            zone->speed = old[j].speed;
+            zone->history = old[j].history;
+            zone->kalman = old[j].kalman;
+
+            // the controllers point into the zone they were started in
+            zone->pid.history = &zone->history;
+            zone->pid.kalman = kalman_enabled() ? &zone->kalman : NULL;
+            zone->classic.history = &zone->history;
+            break;
+        }
+    }
+
+    return count;
+}
+
+bool zones_set_controller(t_zone* zones, int count, bool pid, char* error, size_t size)
+{
+    for (int i = 0; pid && i < count; i++) {
+        const float* k = zones[i].config.thresholds.pid_values;
+
+        if (k[0] == 0 && k[1] == 0 && k[2] == 0) {
+            snprintf(error, size, "Zone %s: the PID controller needs pid_values", zones[i].config.name);
+            return false;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (zones[i].config.pid != pid) {
+            zones[i].config.pid = pid;
+            start_controller(&zones[i]);
+        }
+    }
+
+    return true;
+}
+
+float zones_compute(t_zone* zones, int count, double now, int* speeds)
+{
+    float hottest = 0;
+
+    for (int i = 0; i < MAX_FANS; i++) {
+        speeds[i] = 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        t_zone* zone = &zones[i];
+
+        zone->temp = aggregate_temp(&sensor_samples, zone->sensor_mask, &zone->config.aggregation);
+
+        if (kalman_enabled()) {
+            zone->temp = kalman_update(&zone->kalman, now, zone->temp);
+        }
+
+        history_push(&zone->history, now, zone->temp);
+
+        if (zone->config.pid) {
+            if (history_interval(&zone->history) > 0) {
+                zone->pid.interval = history_interval(&zone->history);
+            }
+            zone->speed = fan_speed_pid(zone->temp, &zone->pid);
+        } else {
+            zone->speed = fan_speed_classic(zone->temp, &zone->classic);
+        }
+
+        for (int fan = 0; fan < MAX_FANS; fan++) {
+            if (zone->fan_mask & (1U << fan)) {
+                speeds[fan] = max(speeds[fan], zone->speed);
+            }
+        }
+
+        hottest = i == 0 ? zone->temp : max(hottest, zone->temp);
+    }
+
+    return hottest;
+}
@@ -0,0 +1,115 @@
+/**
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _ZONES_H_
+#define _ZONES_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mbpfan.h"
+#include "settings.h"
+#include "aggregate.h"
+
+#define MAX_ZONES 8
+
+/** A [zone.<name>] section of the configuration file
+ *  sensors - comma-delimited hwmon drivers or sensor labels, empty for all sensors
+ *  fans - comma-delimited fan names, empty for all fans
+ *  thresholds, aggregation - the [general] values unless set in the section
+ *  pid - use the PID controller, the default when pid_values is set
+ */
+typedef struct {
+    char name[32];
+    char sensors[128];
+    char fans[10 * MAX_FANS];
+    t_thresholds thresholds;
+    t_aggregation aggregation;
+    bool pid;
+} t_zone_config;
+
+/** Zones read from the configuration file, none means a single zone
+ *  with all sensors and fans driven by the [general] settings
+ */
+extern t_zone_config zone_configs[MAX_ZONES];
+extern int zone_count;
+
+/** A zone bound to the sensors and fans lists, with its own controller
+ *  sensor_mask - bit i is set for the i-th sensor of the list
+ *  fan_mask - bit i is set for the i-th fan of the list
+ *  temp, speed - latest aggregated temperature and base fan speed
+ *  history - samples of temp, read by the controller
+ *  kalman - estimate of temp when the Kalman filter is enabled
+ */
+typedef struct {
+    t_zone_config config;
+    uint64_t sensor_mask;
+    unsigned int fan_mask;
+    t_state_classic classic;
+    t_state_pid pid;
+    float temp;
+    int speed;
+    t_history history;
+    t_kalman kalman;
+} t_zone;
+
+/**
+ * Read the [zone.*] sections into configs, the keys missing from a section
+ * take their value from defaults.
+ * Return the number of zones, -1 with the reason in error if one is invalid
+ */
+int zones_read_settings(const Settings* settings, const t_zone_config* defaults,
+                        t_zone_config* configs, char* error, size_t size);
+
+/**
+ * Return true if a configured zone lists the given hwmon driver
+ */
+bool zones_want_driver(const char* driver);
+
+/**
+ * Return false with the reason in error if a zone has no sensor or names
+ * a fan missing from the lists
+ */
+bool zones_check(const t_zone_config* configs, int count, t_sensors* sensors, t_fans* fans,
+                 char* error, size_t size);
+
+/**
+ * Bind the configured zones to the sensors and fans lists and start their
+ * controllers with the current sensor_samples. Return the number of zones
+ */
+int zones_init(t_zone* zones, t_sensors* sensors, t_fans* fans);
+
+/**
+ * Bind the zones again after a reload. A zone whose configuration and
+ * temp_window did not change keeps its controller state and history,
+ * the others start over. Return the number of zones
+ */
+int zones_reload(t_zone* zones, int old_count, t_sensors* sensors, t_fans* fans);
+
+/**
+ * Run the controller of every zone on the current sensor_samples.
+ * speeds receives the base speed of each fan of the list, the highest
+ * demand of the zones serving it, or 0 if it is in no zone.
+ * now is the time of the samples in seconds.
+ * Return the temperature of the hottest zone
+ */
+float zones_compute(t_zone* zones, int count, double now, int* speeds);
+
+/**
+ * Restart every zone with the PID (pid true) or the classic controller,
+ * until the next reload. Return false with the reason in error if a zone
+ * has no PID constants
+ */
+bool zones_set_controller(t_zone* zones, int count, bool pid, char* error, size_t size);
+
+#endif